@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "interpreter2.h"
+
+// blocks up to POOL_MAX_SIZE are rounded up to a multiple of POOL_STEP and kept on a free list
+// per size, larger ones go to malloc
+#define POOL_STEP 16
+#define POOL_MAX_SIZE 512
+#define POOL_CLASSES (POOL_MAX_SIZE / POOL_STEP)
+#define POOL_SLAB_SIZE (64 * 1024)
+
+_Static_assert(POOL_STEP % _Alignof(max_align_t) == 0, "pool blocks must be aligned for any value");
+
+static void *malloc_alloc(void *, size_t size)
+{
+  return malloc(size);
+}
+
+static void *malloc_realloc(void *, void *ptr, size_t, size_t new_size)
+{
+  return realloc(ptr, new_size);
+}
+
+static void malloc_free(void *, void *ptr, size_t)
+{
+  free(ptr);
+}
+
+const allocator_t malloc_allocator = {.alloc = malloc_alloc, .realloc = malloc_realloc, .free = malloc_free};
+
+typedef struct pool_block
+{
+  struct pool_block *next;
+} pool_block_t;
+
+typedef struct pool_slab
+{
+  struct pool_slab *next;
+  max_align_t data[];
+} pool_slab_t;
+
+struct pool
+{
+  allocator_t allocator;
+  pool_block_t *free_blocks[POOL_CLASSES];
+  // every slab carved so far, returned to malloc when the pool is destroyed
+  pool_slab_t *slabs;
+  char *slab_next;
+  size_t slab_left;
+};
+
+static size_t size_class(size_t size)
+{
+  return size <= POOL_STEP ? 0 : (size - 1) / POOL_STEP;
+}
+
+static void *pool_alloc(void *ctx, size_t size)
+{
+  if (size > POOL_MAX_SIZE)
+    return malloc(size);
+  pool_t *pool = ctx;
+  const size_t class = size_class(size);
+  pool_block_t *block = pool->free_blocks[class];
+  if (block != nullptr)
+  {
+    pool->free_blocks[class] = block->next;
+    return block;
+  }
+  const size_t block_size = (class + 1) * POOL_STEP;
+  if (pool->slab_left < block_size)
+  {
+    // the rest of the old slab is left unused
+    pool_slab_t *slab = malloc(sizeof(pool_slab_t) + POOL_SLAB_SIZE);
+    if (slab == nullptr)
+      return nullptr;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->slab_next = (char *)slab->data;
+    pool->slab_left = POOL_SLAB_SIZE;
+  }
+  void *result = pool->slab_next;
+  pool->slab_next += block_size;
+  pool->slab_left -= block_size;
+  return result;
+}
+
+static void pool_free(void *ctx, void *ptr, size_t size)
+{
+  if (ptr == nullptr)
+    return;
+  if (size > POOL_MAX_SIZE)
+  {
+    free(ptr);
+    return;
+  }
+  pool_t *pool = ctx;
+  const size_t class = size_class(size);
+  pool_block_t *block = ptr;
+  block->next = pool->free_blocks[class];
+  pool->free_blocks[class] = block;
+}
+
+static void *pool_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+  if (ptr == nullptr)
+    return pool_alloc(ctx, new_size);
+  if (old_size > POOL_MAX_SIZE && new_size > POOL_MAX_SIZE)
+    return realloc(ptr, new_size);
+  if (old_size <= POOL_MAX_SIZE && new_size <= POOL_MAX_SIZE && size_class(old_size) == size_class(new_size))
+    return ptr;
+  void *result = pool_alloc(ctx, new_size);
+  if (result == nullptr)
+    return nullptr;
+  memcpy(result, ptr, old_size < new_size ? old_size : new_size);
+  pool_free(ctx, ptr, old_size);
+  return result;
+}
+
+pool_t *pool_create(void)
+{
+  pool_t *pool = calloc(1, sizeof(pool_t));
+  check_exit(pool != nullptr, "out of memory");
+  pool->allocator = (allocator_t){.alloc = pool_alloc, .realloc = pool_realloc, .free = pool_free, .ctx = pool};
+  return pool;
+}
+
+const allocator_t *pool_get_allocator(pool_t *pool)
+{
+  return &pool->allocator;
+}
+
+void pool_destroy(pool_t *pool)
+{
+  if (pool == nullptr)
+    return;
+  pool_slab_t *slab = pool->slabs;
+  while (slab != nullptr)
+  {
+    pool_slab_t *next = slab->next;
+    free(slab);
+    slab = next;
+  }
+  free(pool);
+}
+
+void *allocator_alloc(const allocator_t *allocator, size_t size)
+{
+  if (allocator == nullptr)
+    allocator = &malloc_allocator;
+  void *result = allocator->alloc(allocator->ctx, size);
+  check_exit(result != nullptr, "out of memory");
+  return result;
+}
+
+void *allocator_realloc(const allocator_t *allocator, void *ptr, size_t old_size, size_t new_size)
+{
+  if (allocator == nullptr)
+    allocator = &malloc_allocator;
+  void *result = allocator->realloc(allocator->ctx, ptr, old_size, new_size);
+  check_exit(result != nullptr, "out of memory");
+  return result;
+}
+
+void allocator_free(const allocator_t *allocator, void *ptr, size_t size)
+{
+  if (allocator == nullptr)
+    allocator = &malloc_allocator;
+  allocator->free(allocator->ctx, ptr, size);
+}
@@ -0,0 +1,492 @@
+// open_memstream is hidden by glibc in strict c2x mode
+#define _DEFAULT_SOURCE
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "interpreter2.h"
+#include "compile.h"
+#include "bytecode.h"
+
+// wunsc translates the top-level forms of a wuns file to a C program that links with
+// aot_runtime.c and rtval.c, and prints the same as running the file with the shell
+
+// the C expressions of the intrinsics, in terms of a and b like the vm's
+static const char *intrinsic_exps[] = {
+#define X(name, exp) [INTRINSIC_##name] = #exp,
+    FOR_EACH_I32_INTRINSIC(X)
+    FOR_EACH_F64_ARITH_INTRINSIC(X)
+    FOR_EACH_F64_CMP_INTRINSIC(X)
+#undef X
+};
+
+typedef struct
+{
+  // where the function being translated is written
+  FILE *out;
+  int indent;
+  // numbers the temporaries and labels of the function
+  int next_temp;
+  // the innermost loop and its label
+  const node_t *loop;
+  int loop_label;
+} aot_t;
+
+static void line(aot_t *a, const char *format, ...)
+{
+  fprintf(a->out, "%*s", a->indent * 2, "");
+  va_list args;
+  va_start(args, format);
+  vfprintf(a->out, format, args);
+  va_end(args);
+  fputc('\n', a->out);
+}
+
+static void open_block(aot_t *a)
+{
+  line(a, "{");
+  a->indent++;
+}
+
+static void close_block(aot_t *a)
+{
+  a->indent--;
+  line(a, "}");
+}
+
+// declare a temporary in the current block, returns its number
+static int temp(aot_t *a)
+{
+  const int t = a->next_temp++;
+  line(a, "rtval_t t%d;", t);
+  return t;
+}
+
+static void emit_node(aot_t *a, const node_t *node, const char *dest, bool tail);
+
+// evaluate node to a new temporary, returns its number
+static int emit_temp(aot_t *a, const node_t *node)
+{
+  const int t = temp(a);
+  char dest[16];
+  snprintf(dest, sizeof(dest), "t%d", t);
+  emit_node(a, node, dest, false);
+  return t;
+}
+
+// values are evaluated to temporaries before they are stored, a binding's value may use its slot
+static void emit_bindings(aot_t *a, size_t size, const node_binding_t *bindings)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    const int t = emit_temp(a, bindings[i].value);
+    line(a, "s[%d] = t%d;", bindings[i].slot, t);
+  }
+}
+
+static void emit_f64(aot_t *a, const char *dest, double f)
+{
+  if (isfinite(f))
+  {
+    line(a, "%s = rtval_make_f64(%a);", dest, f);
+    return;
+  }
+  uint64_t bits;
+  memcpy(&bits, &f, sizeof(double));
+  line(a, "%s = rtval_make_f64(aot_f64_from_bits(0x%llxull));", dest, (unsigned long long)bits);
+}
+
+// operands proven to have the argument type are not checked
+static void emit_intrinsic(aot_t *a, const node_t *node, const char *dest)
+{
+  const intrinsic_type_t op = node->intrinsic.op;
+  const bool checked = node->kind == N_INTRINSIC;
+  open_block(a);
+  const int ta = emit_temp(a, node->intrinsic.a);
+  const int tb = emit_temp(a, node->intrinsic.b);
+  switch (intrinsic_kind(op))
+  {
+  case INTRINSIC_KIND_I32:
+    if (checked)
+      line(a, "check_exit(rtval_get_tag(t%d) == rtval_i32 && rtval_get_tag(t%d) == rtval_i32, \"intrinsic requires i32 arguments\");", ta, tb);
+    line(a, "const int32_t a = rtval_get_i32(t%d), b = rtval_get_i32(t%d);", ta, tb);
+    line(a, "%s = rtval_make_i32(%s);", dest, intrinsic_exps[op]);
+    break;
+  case INTRINSIC_KIND_F64_ARITH:
+  case INTRINSIC_KIND_F64_CMP:
+    if (checked)
+      line(a, "check_exit(rtval_get_tag(t%d) == rtval_f64 && rtval_get_tag(t%d) == rtval_f64, \"intrinsic requires f64 arguments\");", ta, tb);
+    line(a, "const double a = rtval_get_f64(t%d), b = rtval_get_f64(t%d);", ta, tb);
+    line(a, "%s = rtval_make_%s(%s);", dest, intrinsic_kind(op) == INTRINSIC_KIND_F64_ARITH ? "f64" : "i32", intrinsic_exps[op]);
+    break;
+  }
+  close_block(a);
+}
+
+static void emit_switch(aot_t *a, const node_t *node, const char *dest, bool tail)
+{
+  open_block(a);
+  const int value = emit_temp(a, node->switch_.value);
+  line(a, "int case_index = -1;");
+  const switch_table_t *table = node->switch_.table;
+  if (table != nullptr)
+  {
+    // the case values are i32 literals, leave the dispatch to the C compiler
+    line(a, "if (rtval_get_tag(t%d) == rtval_i32)", value);
+    a->indent++;
+    line(a, "switch (rtval_get_i32(t%d))", value);
+    open_block(a);
+    for (size_t i = 0; i < table->size; i++)
+    {
+      const int case_index = table->cases[i];
+      if (case_index < 0)
+        continue;
+      const int32_t key = table->dense ? table->min + (int32_t)i : table->keys[i];
+      line(a, "case %lld:", (long long)key);
+      line(a, "  case_index = %d;", case_index);
+      line(a, "  break;");
+    }
+    close_block(a);
+    a->indent--;
+  }
+  else
+  {
+    // case values are evaluated in order until one matches
+    for (size_t i = 0; i < node->switch_.size; i++)
+    {
+      const switch_case_t *switch_case = &node->switch_.cases[i];
+      for (size_t j = 0; j < switch_case->size; j++)
+      {
+        line(a, "if (case_index < 0)");
+        open_block(a);
+        const int case_value = emit_temp(a, switch_case->values[j]);
+        line(a, "if (aot_switch_match(t%d, t%d))", value, case_value);
+        line(a, "  case_index = %zu;", i);
+        close_block(a);
+      }
+    }
+  }
+  line(a, "switch (case_index)");
+  open_block(a);
+  for (size_t i = 0; i < node->switch_.size; i++)
+  {
+    line(a, "case %zu:", i);
+    open_block(a);
+    emit_node(a, node->switch_.cases[i].body, dest, tail);
+    line(a, "break;");
+    close_block(a);
+  }
+  line(a, "default:");
+  open_block(a);
+  emit_node(a, node->switch_.default_case, dest, tail);
+  close_block(a);
+  close_block(a);
+  close_block(a);
+}
+
+static void emit_call(aot_t *a, const node_t *node, const char *dest, bool tail)
+{
+  open_block(a);
+  const int fn = emit_temp(a, node->call.fn);
+  const int num_args = node->call.size;
+  line(a, "const rtfunc_t *func = aot_callee(t%d, %d);", fn, num_args);
+  // arguments may call functions too, their frames go above this one
+  line(a, "rtval_t *args = aot_push_frame(func, %d);", num_args);
+  for (int i = 0; i < num_args; i++)
+  {
+    const int arg = emit_temp(a, node->call.args[i]);
+    line(a, "args[%d] = t%d;", i, arg);
+  }
+  if (tail)
+    line(a, "return aot_tail_call(func, slots, args, %d);", num_args);
+  else
+    line(a, "%s = aot_call(func, args, %d);", dest, num_args);
+  close_block(a);
+}
+
+// the form as the shell prints it, as a C string literal
+static void emit_form_string(FILE *out, const form_t *form)
+{
+  if (form->type == T_LIST)
+  {
+    fputc('[', out);
+    for (size_t i = 0; i < form->list->size; i++)
+    {
+      if (i > 0)
+        fputc(' ', out);
+      emit_form_string(out, form->list->cells[i]);
+    }
+    fputc(']', out);
+    return;
+  }
+  for (const char *c = form->word->chars; *c; c++)
+  {
+    if (*c == '"' || *c == '\\')
+      fprintf(out, "\\%c", *c);
+    else if (*c < ' ' || *c > '~')
+      fprintf(out, "\\%03o", (unsigned char)*c);
+    else
+      fputc(*c, out);
+  }
+}
+
+// assigns the value of node to the C variable dest, in tail position a call returns instead
+static void emit_node(aot_t *a, const node_t *node, const char *dest, bool tail)
+{
+  switch (node->kind)
+  {
+  case N_I32:
+    line(a, "%s = rtval_make_i32(%lld);", dest, (long long)node->i32);
+    return;
+  case N_F64:
+    emit_f64(a, dest, node->f64);
+    return;
+  case N_FORM:
+  {
+    // only word forms are compiled from the source, macro arguments are not translated
+    char *chars = nullptr;
+    size_t size;
+    FILE *literal = open_memstream(&chars, &size);
+    emit_form_string(literal, node->form);
+    fclose(literal);
+    line(a, "%s = aot_word_form(\"%s\");", dest, chars);
+    free(chars);
+    return;
+  }
+  case N_LOCAL:
+    line(a, "%s = s[%d];", dest, node->slot);
+    return;
+  case N_GLOBAL:
+    line(a, "%s = globals[%d];", dest, node->slot);
+    // slots are reserved when referenced, so a reference may precede its definition
+    line(a, "check_exit(rtval_get_tag(%s) != rtval_undefined, \"word not found in env\");", dest);
+    return;
+  case N_INTRINSIC:
+  case N_INTRINSIC_UNCHECKED:
+    emit_intrinsic(a, node, dest);
+    return;
+  case N_CHECK:
+    emit_node(a, node->check.value, dest, false);
+    line(a, "check_exit(rtval_get_tag(%s) == %s, \"value does not have its annotated type\");", dest, node->type == TYPE_I32 ? "rtval_i32" : "rtval_f64");
+    return;
+  case N_IF:
+  {
+    open_block(a);
+    const int cond = emit_temp(a, node->if_.cond);
+    line(a, "check_exit(rtval_get_tag(t%d) == rtval_i32, \"if requires i32 condition\");", cond);
+    line(a, "if (rtval_get_i32(t%d))", cond);
+    open_block(a);
+    emit_node(a, node->if_.then, dest, tail);
+    close_block(a);
+    line(a, "else");
+    open_block(a);
+    emit_node(a, node->if_.otherwise, dest, tail);
+    close_block(a);
+    close_block(a);
+    return;
+  }
+  case N_DO:
+    if (node->seq.size == 0)
+    {
+      line(a, "%s = rtval_make_undefined();", dest);
+      return;
+    }
+    open_block(a);
+    for (size_t i = 0; i < node->seq.size - 1; i++)
+      line(a, "(void)t%d;", emit_temp(a, node->seq.exps[i]));
+    emit_node(a, node->seq.exps[node->seq.size - 1], dest, tail);
+    close_block(a);
+    return;
+  case N_LET:
+    open_block(a);
+    emit_bindings(a, node->let.size, node->let.bindings);
+    emit_node(a, node->let.body, dest, tail);
+    close_block(a);
+    return;
+  case N_LOOP:
+  {
+    open_block(a);
+    emit_bindings(a, node->let.size, node->let.bindings);
+    const node_t *outer_loop = a->loop;
+    const int outer_label = a->loop_label;
+    a->loop = node;
+    a->loop_label = a->next_temp++;
+    line(a, "loop%d:;", a->loop_label);
+    if (node->let.jump_continues)
+    {
+      // continues jump back to the body, so it is in tail position
+      emit_node(a, node->let.body, dest, tail);
+    }
+    else
+    {
+      emit_node(a, node->let.body, dest, false);
+      line(a, "if (rtval_get_tag(%s) == rtval_continue)", dest);
+      line(a, "  goto loop%d;", a->loop_label);
+    }
+    a->loop = outer_loop;
+    a->loop_label = outer_label;
+    close_block(a);
+    return;
+  }
+  case N_CONTINUE:
+    open_block(a);
+    emit_bindings(a, node->cont.size, node->cont.bindings);
+    if (node->cont.loop != nullptr)
+    {
+      check_exit(node->cont.loop == a->loop, "continue does not target the innermost loop");
+      line(a, "goto loop%d;", a->loop_label);
+    }
+    else
+    {
+      line(a, "%s = rtval_make_continue();", dest);
+    }
+    close_block(a);
+    return;
+  case N_SWITCH:
+    emit_switch(a, node, dest, tail);
+    return;
+  case N_CALL:
+    emit_call(a, node, dest, tail);
+    return;
+  case N_DEF:
+  case N_DEFN:
+    exitWithError("unexpected top special form in exp");
+  }
+  exitWithError("unknown node");
+}
+
+// a C function running body on a frame of frame_size slots, the first num_params are arguments
+static void emit_function(FILE *out, const char *name, const node_t *body, int frame_size, int num_params)
+{
+  aot_t a = {.out = out, .indent = 1};
+  fprintf(out, "static rtval_t %s([[maybe_unused]] rtval_t *slots)\n{\n", name);
+  // the locals are copied out of the frame so the C compiler can keep them in registers
+  line(&a, "[[maybe_unused]] rtval_t s[%d];", frame_size > 0 ? frame_size : 1);
+  if (num_params > 0)
+    line(&a, "memcpy(s, slots, sizeof(rtval_t) * %d);", num_params);
+  line(&a, "rtval_t result;");
+  emit_node(&a, body, "result", true);
+  line(&a, "return result;");
+  fprintf(out, "}\n\n");
+}
+
+typedef struct
+{
+  def_env_t denv;
+  // function definitions and the statements of main
+  FILE *functions;
+  FILE *main;
+  int next_function;
+} translation_t;
+
+static void translate_form(translation_t *t, const form_t *form)
+{
+  int frame_size;
+  const node_t *node = compile_top(&t->denv, form, &frame_size);
+  char name[32];
+  snprintf(name, sizeof(name), "f%d", t->next_function++);
+  fprintf(t->main, "  aot_print_form(\"");
+  emit_form_string(t->main, form);
+  fprintf(t->main, "\");\n");
+  switch (node->kind)
+  {
+  case N_DEF:
+    emit_function(t->functions, name, node->def.value, frame_size, 0);
+    fprintf(t->main, "  globals[%d] = aot_run(%s, %d);\n", node->def.slot, name, frame_size);
+    fprintf(t->main, "  aot_print_result(globals[%d]);\n", node->def.slot);
+    break;
+  case N_DEFN:
+  {
+    // macros run while translating, along with the functions they call
+    define_func(&t->denv, node);
+    const int num_params = node->defn.arity + (node->defn.has_rest ? 1 : 0);
+    emit_function(t->functions, name, node->defn.body, node->defn.frame_size, num_params);
+    fprintf(t->main, "  globals[%d] = aot_func(\"", node->defn.slot);
+    emit_form_string(t->main, &(form_t){.type = T_WORD, .word = node->defn.name});
+    fprintf(t->main, "\", %d, %s, %s, %d, %s);\n", node->defn.arity, node->defn.has_rest ? "true" : "false", node->defn.rest_unread ? "true" : "false", node->defn.frame_size, name);
+    fprintf(t->main, "  aot_print_result(globals[%d]);\n", node->defn.slot);
+    break;
+  }
+  default:
+    emit_function(t->functions, name, node, frame_size, 0);
+    fprintf(t->main, "  aot_print_result(aot_run(%s, %d));\n", name, frame_size);
+    break;
+  }
+}
+
+static char *read_file(const char *filename, size_t *size)
+{
+  FILE *file = filename ? fopen(filename, "r") : stdin;
+  if (file == NULL)
+  {
+    perror("Error opening file");
+    exit(1);
+  }
+  char *buffer = nullptr;
+  FILE *contents = open_memstream(&buffer, size);
+  char chunk[64 * 1024];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    fwrite(chunk, 1, n, contents);
+  fclose(contents);
+  if (file != stdin)
+    fclose(file);
+  return buffer;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc > 2 || (argc == 2 && argv[1][0] == '-'))
+  {
+    fprintf(stderr, "usage: %s [file]\n", argv[0]);
+    fprintf(stderr, "  translate a wuns file to a C program on stdout, link it with aot_runtime.c and rtval.c\n");
+    return 1;
+  }
+  size_t size;
+  char *source = read_file(argc == 2 ? argv[1] : NULL, &size);
+
+  translation_t t = {0};
+  def_env_init(&t.denv, ENGINE_VM, nullptr);
+  char *functions, *main_body;
+  size_t functions_size, main_size;
+  t.functions = open_memstream(&functions, &functions_size);
+  t.main = open_memstream(&main_body, &main_size);
+
+  arena_t forms = {.allocator = t.denv.allocator};
+  parser_t *parser = parser_create(&forms, nullptr, nullptr);
+  const char *start = source;
+  const char *end = source + size;
+  while (start < end)
+  {
+    const form_t *form = parse_one(parser, &start, end);
+    if (!form)
+      break;
+    translate_form(&t, form);
+    arena_reset(&forms);
+  }
+  parser_free(parser);
+  arena_free(&forms);
+  fclose(t.functions);
+  fclose(t.main);
+
+  // the globals are known once every form is compiled
+  printf("#include \"aot_runtime.h\"\n\n");
+  printf("static rtval_t globals[%d];\n\n", t.denv.size > 0 ? t.denv.size : 1);
+  for (int i = 0; i < t.next_function; i++)
+    printf("static rtval_t f%d(rtval_t *slots);\n", i);
+  printf("\n%s", functions);
+  printf("int main(void)\n{\n");
+  printf("  for (int i = 0; i < %d; i++)\n    globals[i] = rtval_make_undefined();\n", t.denv.size);
+  printf("%s", main_body);
+  printf("  return 0;\n}\n");
+
+  free(functions);
+  free(main_body);
+  free(source);
+  def_env_free(&t.denv);
+  return 0;
+}
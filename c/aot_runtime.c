@@ -0,0 +1,150 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "aot_runtime.h"
+
+#define VALUE_STACK_SIZE (1024 * 1024)
+
+typedef struct
+{
+  rtfunc_t func;
+  aot_native_t native;
+} aot_func_t;
+
+// frames of calls and top-level forms, allocated on first use and never moved
+static rtval_t *stack_values;
+static rtval_t *stack_top;
+// set by a call in tail position for the aot_call or aot_run below it to run
+static const rtfunc_t *pending;
+
+static rtval_t *value_stack_push(int size)
+{
+  if (stack_values == nullptr)
+  {
+    stack_values = malloc(sizeof(rtval_t) * VALUE_STACK_SIZE);
+    stack_top = stack_values;
+  }
+  check_exit(stack_top + size <= stack_values + VALUE_STACK_SIZE, "stack overflow");
+  rtval_t *slots = stack_top;
+  stack_top += size;
+  return slots;
+}
+
+// words are not interned at runtime
+static const word_t *make_word(const char *chars)
+{
+  const size_t size = strlen(chars);
+  word_t *word = malloc(sizeof(word_t) + size + 1);
+  word->id = 0;
+  word->size = size;
+  memcpy(word->chars, chars, size + 1);
+  return word;
+}
+
+rtval_t aot_func(const char *name, int arity, bool has_rest, bool rest_unread, int frame_size, aot_native_t native)
+{
+  const aot_func_t func = {
+      .func = {.name = make_word(name), .arity = arity, .has_rest = has_rest, .rest_unread = rest_unread, .frame_size = frame_size},
+      .native = native};
+  aot_func_t *funcp = malloc(sizeof(aot_func_t));
+  memcpy(funcp, &func, sizeof(aot_func_t));
+  return rtval_make_func(&funcp->func);
+}
+
+rtval_t aot_word_form(const char *chars)
+{
+  form_t *form = malloc(sizeof(form_t));
+  *form = (form_t){.type = T_WORD, .word = make_word(chars)};
+  return rtval_make_form(form);
+}
+
+const rtfunc_t *aot_callee(rtval_t fn, int num_args)
+{
+  check_exit(rtval_get_tag(fn) == rtval_func, "expected function");
+  const rtfunc_t *func = rtval_get_func(fn);
+  check_exit(num_args >= func->arity, "too few arguments");
+  return func;
+}
+
+rtval_t *aot_push_frame(const rtfunc_t *func, int num_args)
+{
+  // rest arguments are evaluated into the frame before they are made a list
+  return value_stack_push(num_args > func->frame_size ? num_args : func->frame_size);
+}
+
+// make the arguments after arity the rest list
+static void bind_rest(const rtfunc_t *func, rtval_t *args, int num_args)
+{
+  if (func->rest_unread)
+  {
+    args[func->arity] = rtval_make_undefined();
+  }
+  else if (func->has_rest)
+  {
+    const int numRest = num_args - func->arity;
+    rtval_list_t *rest = malloc(sizeof(rtval_list_t) + sizeof(rtval_t) * numRest);
+    rest->size = numRest;
+    memcpy(rest->values, args + func->arity, sizeof(rtval_t) * numRest);
+    args[func->arity] = rtval_make_list(rest);
+  }
+  else
+  {
+    check_exit(num_args == func->arity, "too many arguments");
+  }
+}
+
+// run native and the calls in tail position it leaves pending, all on the frame in slots
+static rtval_t trampoline(aot_native_t native, rtval_t *slots)
+{
+  rtval_t result = native(slots);
+  while (pending != nullptr)
+  {
+    const aot_func_t *func = (const aot_func_t *)pending;
+    pending = nullptr;
+    result = func->native(slots);
+  }
+  stack_top = slots;
+  return result;
+}
+
+rtval_t aot_call(const rtfunc_t *func, rtval_t *args, int num_args)
+{
+  bind_rest(func, args, num_args);
+  return trampoline(((const aot_func_t *)func)->native, args);
+}
+
+rtval_t aot_tail_call(const rtfunc_t *func, rtval_t *slots, rtval_t *args, int num_args)
+{
+  bind_rest(func, args, num_args);
+  memmove(slots, args, sizeof(rtval_t) * func->frame_size);
+  stack_top = slots + func->frame_size;
+  pending = func;
+  return rtval_make_undefined();
+}
+
+rtval_t aot_run(aot_native_t native, int frame_size)
+{
+  return trampoline(native, value_stack_push(frame_size));
+}
+
+bool aot_switch_match(rtval_t value, rtval_t case_value)
+{
+  if (rtval_get_tag(case_value) != rtval_get_tag(value))
+    return false;
+  return (rtval_get_tag(case_value) == rtval_i32 && rtval_get_i32(case_value) == rtval_get_i32(value)) ||
+         (rtval_get_tag(case_value) == rtval_f64 && rtval_get_f64(case_value) == rtval_get_f64(value));
+}
+
+void aot_print_form(const char *form)
+{
+  printf("%s", form);
+}
+
+void aot_print_result(rtval_t value)
+{
+  printf(" => ");
+  print_rtval(&value);
+  printf("\n");
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string.h>
+
+#include "interpreter2.h"
+
+// the runtime of programs translated to C by wunsc, linked with rtval.c only
+
+// the code of a function or top-level form, slots is its frame on the value stack
+// with the arguments in the first slots
+typedef rtval_t (*aot_native_t)(rtval_t *slots);
+
+// a function value, allocated each time its defn form is evaluated like in the interpreter
+rtval_t aot_func(const char *name, int arity, bool has_rest, bool rest_unread, int frame_size, aot_native_t native);
+
+// a word form, made each time it is evaluated as word forms are mostly used by macros
+rtval_t aot_word_form(const char *chars);
+
+// check fn can be called with num_args arguments and push a frame for them
+const rtfunc_t *aot_callee(rtval_t fn, int num_args);
+rtval_t *aot_push_frame(const rtfunc_t *func, int num_args);
+// run func on the frame from aot_push_frame holding the arguments and pop it
+rtval_t aot_call(const rtfunc_t *func, rtval_t *args, int num_args);
+// for a call in tail position, move the arguments down over the caller's frame in slots
+// the caller returns the result and the function is run by the aot_call or aot_run below it
+rtval_t aot_tail_call(const rtfunc_t *func, rtval_t *slots, rtval_t *args, int num_args);
+// run the code of a top-level form
+rtval_t aot_run(aot_native_t native, int frame_size);
+
+// the value of a switch matches a case value of the same tag and number
+bool aot_switch_match(rtval_t value, rtval_t case_value);
+
+// nan and infinity literals keep their bits
+static inline double aot_f64_from_bits(uint64_t bits)
+{
+  double f;
+  memcpy(&f, &bits, sizeof(double));
+  return f;
+}
+
+// print a top-level form and its value the way the interpreter's shell does
+void aot_print_form(const char *form);
+void aot_print_result(rtval_t value);
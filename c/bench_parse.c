@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "scan.h"
+
+// tokenizes the given files with every scan implementation the cpu supports and reports MB/s
+
+#define MIN_BENCH_BYTES (256 * 1024 * 1024)
+
+typedef struct
+{
+  char *start;
+  size_t size;
+} source_t;
+
+static bool read_source(const char *filename, source_t *source)
+{
+  FILE *file = fopen(filename, "r");
+  if (file == NULL)
+  {
+    perror(filename);
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  const long size = ftell(file);
+  rewind(file);
+  source->start = malloc(size);
+  source->size = fread(source->start, 1, size, file);
+  fclose(file);
+  return true;
+}
+
+// the same word/whitespace split parse_one performs, other bytes count as single tokens
+static size_t tokenize(const scan_impl_t *impl, const char *cur, const char *end)
+{
+  size_t tokens = 0;
+  while (cur < end)
+  {
+    const char c = *cur;
+    if (is_word_char(c))
+    {
+      cur = impl->word_end(cur + 1, end);
+      tokens++;
+    }
+    else if (is_whitespace(c))
+    {
+      cur = impl->whitespace_end(cur + 1, end);
+    }
+    else
+    {
+      cur++;
+      tokens++;
+    }
+  }
+  return tokens;
+}
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s file.wuns...\n", argv[0]);
+    return 1;
+  }
+  const int source_count = argc - 1;
+  source_t *sources = malloc(sizeof(source_t) * source_count);
+  size_t total_bytes = 0;
+  for (int i = 0; i < source_count; i++)
+  {
+    if (!read_source(argv[i + 1], &sources[i]))
+      return 1;
+    total_bytes += sources[i].size;
+  }
+  if (total_bytes == 0)
+  {
+    fprintf(stderr, "no input\n");
+    return 1;
+  }
+  const size_t rounds = MIN_BENCH_BYTES / total_bytes + 1;
+
+  int impl_count;
+  const scan_impl_t *const *impls = scan_supported_impls(&impl_count);
+  double scalar_mbs = 0;
+  printf("%zu bytes in %d files, %zu rounds\n", total_bytes, source_count, rounds);
+  for (int i = 0; i < impl_count; i++)
+  {
+    const scan_impl_t *impl = impls[i];
+    size_t tokens = 0;
+    const double start = now_seconds();
+    for (size_t r = 0; r < rounds; r++)
+      for (int j = 0; j < source_count; j++)
+        tokens += tokenize(impl, sources[j].start, sources[j].start + sources[j].size);
+    const double elapsed = now_seconds() - start;
+    const double mbs = (double)total_bytes * rounds / elapsed / 1e6;
+    if (i == 0)
+      scalar_mbs = mbs;
+    printf("%-8s %10.1f MB/s  %5.2fx  (%zu tokens per round)\n", impl->name, mbs, mbs / scalar_mbs, tokens / rounds);
+  }
+  for (int i = 0; i < source_count; i++)
+    free(sources[i].start);
+  free(sources);
+  return 0;
+}
@@ -0,0 +1,675 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+
+#include "bytecode.h"
+#include "jit.h"
+
+#define INIT_CODE_CAPACITY 64
+#define VM_STACK_SIZE (1024 * 1024)
+#define VM_MAX_CALL_DEPTH (64 * 1024)
+
+typedef struct
+{
+  const allocator_t *allocator;
+  size_t size;
+  size_t capacity;
+  int32_t *code;
+  size_t f64_size;
+  size_t f64_capacity;
+  double *f64s;
+  size_t form_size;
+  size_t form_capacity;
+  const form_t **forms;
+  size_t table_size;
+  size_t table_capacity;
+  const switch_table_t **tables;
+  // operand stack depth at the current point of the code
+  int depth;
+  int max_depth;
+  // start of the innermost loop body, a continue in tail position jumps there
+  size_t loop_top;
+} emitter_t;
+
+static void emit(emitter_t *e, int32_t word)
+{
+  if (e->size == e->capacity)
+  {
+    const size_t old_capacity = e->capacity;
+    e->capacity = old_capacity ? old_capacity * 2 : INIT_CODE_CAPACITY;
+    e->code = allocator_realloc(e->allocator, e->code, sizeof(int32_t) * old_capacity, sizeof(int32_t) * e->capacity);
+  }
+  e->code[e->size++] = word;
+}
+
+static void emit_op(emitter_t *e, opcode_t op, int stack_effect)
+{
+  emit(e, op);
+  e->depth += stack_effect;
+  if (e->depth > e->max_depth)
+    e->max_depth = e->depth;
+}
+
+// emit a jump to be patched later, returns the position of its target
+static size_t emit_jump(emitter_t *e, opcode_t op, int stack_effect)
+{
+  emit_op(e, op, stack_effect);
+  emit(e, -1);
+  return e->size - 1;
+}
+
+static void patch_jump(emitter_t *e, size_t at)
+{
+  e->code[at] = e->size;
+}
+
+static int32_t add_f64(emitter_t *e, double value)
+{
+  if (e->f64_size == e->f64_capacity)
+  {
+    const size_t old_capacity = e->f64_capacity;
+    e->f64_capacity = old_capacity ? old_capacity * 2 : INIT_CODE_CAPACITY;
+    e->f64s = allocator_realloc(e->allocator, e->f64s, sizeof(double) * old_capacity, sizeof(double) * e->f64_capacity);
+  }
+  e->f64s[e->f64_size] = value;
+  return e->f64_size++;
+}
+
+static int32_t add_form(emitter_t *e, const form_t *form)
+{
+  if (e->form_size == e->form_capacity)
+  {
+    const size_t old_capacity = e->form_capacity;
+    e->form_capacity = old_capacity ? old_capacity * 2 : INIT_CODE_CAPACITY;
+    e->forms = allocator_realloc(e->allocator, e->forms, sizeof(form_t *) * old_capacity, sizeof(form_t *) * e->form_capacity);
+  }
+  e->forms[e->form_size] = form;
+  return e->form_size++;
+}
+
+static int32_t add_table(emitter_t *e, const switch_table_t *table)
+{
+  if (e->table_size == e->table_capacity)
+  {
+    const size_t old_capacity = e->table_capacity;
+    e->table_capacity = old_capacity ? old_capacity * 2 : INIT_CODE_CAPACITY;
+    e->tables = allocator_realloc(e->allocator, e->tables, sizeof(switch_table_t *) * old_capacity, sizeof(switch_table_t *) * e->table_capacity);
+  }
+  e->tables[e->table_size] = table;
+  return e->table_size++;
+}
+
+static opcode_t intrinsic_op(intrinsic_type_t t, bool unchecked)
+{
+  switch (t)
+  {
+#define X(name, expr)    \
+  case INTRINSIC_##name: \
+    return unchecked ? OP_##name##_UNCHECKED : OP_##name;
+    FOR_EACH_I32_INTRINSIC(X)
+    FOR_EACH_F64_ARITH_INTRINSIC(X)
+    FOR_EACH_F64_CMP_INTRINSIC(X)
+#undef X
+  }
+  exitWithError("unknown intrinsic");
+  exit(1);
+}
+
+typedef enum
+{
+  TAIL_NONE,
+  // the value of the node is the value of the innermost loop body
+  TAIL_LOOP,
+  // the value of the node is returned from the function or top-level form
+  TAIL_RETURN,
+} tail_t;
+
+static void emit_node(emitter_t *e, const node_t *node, tail_t tail)
+{
+  switch (node->kind)
+  {
+  case N_I32:
+    emit_op(e, OP_I32, 1);
+    emit(e, node->i32);
+    return;
+  case N_F64:
+    emit_op(e, OP_F64, 1);
+    emit(e, add_f64(e, node->f64));
+    return;
+  case N_FORM:
+    emit_op(e, OP_FORM, 1);
+    emit(e, add_form(e, node->form));
+    return;
+  case N_LOCAL:
+    emit_op(e, OP_LOCAL, 1);
+    emit(e, node->slot);
+    return;
+  case N_GLOBAL:
+    emit_op(e, OP_GLOBAL, 1);
+    emit(e, node->slot);
+    return;
+  case N_INTRINSIC:
+  case N_INTRINSIC_UNCHECKED:
+    emit_node(e, node->intrinsic.a, TAIL_NONE);
+    emit_node(e, node->intrinsic.b, TAIL_NONE);
+    emit_op(e, intrinsic_op(node->intrinsic.op, node->kind == N_INTRINSIC_UNCHECKED), -1);
+    return;
+  case N_CHECK:
+    emit_node(e, node->check.value, TAIL_NONE);
+    emit_op(e, OP_CHECK, 0);
+    emit(e, value_type_tag(node->type));
+    return;
+  case N_IF:
+  {
+    emit_node(e, node->if_.cond, TAIL_NONE);
+    const size_t to_otherwise = emit_jump(e, OP_JUMP_IF_FALSE, -1);
+    emit_node(e, node->if_.then, tail);
+    const size_t to_end = emit_jump(e, OP_JUMP, -1);
+    patch_jump(e, to_otherwise);
+    emit_node(e, node->if_.otherwise, tail);
+    patch_jump(e, to_end);
+    return;
+  }
+  case N_DO:
+  {
+    const size_t size = node->seq.size;
+    if (size == 0)
+    {
+      emit_op(e, OP_UNDEFINED, 1);
+      return;
+    }
+    for (size_t i = 0; i < size - 1; i++)
+    {
+      emit_node(e, node->seq.exps[i], TAIL_NONE);
+      emit_op(e, OP_POP, -1);
+    }
+    emit_node(e, node->seq.exps[size - 1], tail);
+    return;
+  }
+  case N_LET:
+  case N_LOOP:
+  {
+    for (size_t i = 0; i < node->let.size; i++)
+    {
+      emit_node(e, node->let.bindings[i].value, TAIL_NONE);
+      emit_op(e, OP_SET_LOCAL, -1);
+      emit(e, node->let.bindings[i].slot);
+    }
+    if (node->kind == N_LET)
+    {
+      emit_node(e, node->let.body, tail);
+      return;
+    }
+    const size_t outer_loop_top = e->loop_top;
+    e->loop_top = e->size;
+    emit_node(e, node->let.body, TAIL_LOOP);
+    if (!node->let.jump_continues)
+    {
+      emit_op(e, OP_LOOP_END, 0);
+      emit(e, e->loop_top);
+    }
+    e->loop_top = outer_loop_top;
+    return;
+  }
+  case N_CONTINUE:
+  {
+    for (size_t i = 0; i < node->cont.size; i++)
+    {
+      emit_node(e, node->cont.bindings[i].value, TAIL_NONE);
+      emit_op(e, OP_SET_LOCAL, -1);
+      emit(e, node->cont.bindings[i].slot);
+    }
+    if (node->cont.loop != nullptr)
+    {
+      assert(tail == TAIL_LOOP && "continue jumps only from tail position");
+      // nothing is left on the operand stack in tail position, so go straight to the next iteration
+      // the code after the jump still expects the value it would have pushed
+      emit_op(e, OP_JUMP, 1);
+      emit(e, e->loop_top);
+    }
+    else
+    {
+      emit_op(e, OP_CONTINUE, 1);
+    }
+    return;
+  }
+  case N_SWITCH:
+  {
+    emit_node(e, node->switch_.value, TAIL_NONE);
+    const size_t size = node->switch_.size;
+    size_t *to_end = allocator_alloc(e->allocator, sizeof(size_t) * (size + 1));
+    if (node->switch_.table != nullptr)
+    {
+      emit_op(e, OP_SWITCH_TABLE, -1);
+      emit(e, add_table(e, node->switch_.table));
+      const size_t targets = e->size;
+      for (size_t i = 0; i <= size; i++)
+        emit(e, -1);
+      for (size_t i = 0; i < size; i++)
+      {
+        patch_jump(e, targets + 1 + i);
+        emit_node(e, node->switch_.cases[i].body, tail);
+        to_end[i] = emit_jump(e, OP_JUMP, -1);
+      }
+      patch_jump(e, targets);
+      emit_node(e, node->switch_.default_case, tail);
+      for (size_t i = 0; i < size; i++)
+        patch_jump(e, to_end[i]);
+      allocator_free(e->allocator, to_end, sizeof(size_t) * (size + 1));
+      return;
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+      const switch_case_t *switch_case = &node->switch_.cases[i];
+      size_t *to_body = allocator_alloc(e->allocator, sizeof(size_t) * switch_case->size);
+      for (size_t j = 0; j < switch_case->size; j++)
+      {
+        emit_node(e, switch_case->values[j], TAIL_NONE);
+        to_body[j] = emit_jump(e, OP_CASE, -1);
+      }
+      const size_t to_next = emit_jump(e, OP_JUMP, 0);
+      for (size_t j = 0; j < switch_case->size; j++)
+        patch_jump(e, to_body[j]);
+      allocator_free(e->allocator, to_body, sizeof(size_t) * switch_case->size);
+      emit_op(e, OP_POP, -1);
+      emit_node(e, switch_case->body, tail);
+      // the body replaced the switch value, so the depth is the same for the next case
+      to_end[i] = emit_jump(e, OP_JUMP, 0);
+      patch_jump(e, to_next);
+    }
+    emit_op(e, OP_POP, -1);
+    emit_node(e, node->switch_.default_case, tail);
+    for (size_t i = 0; i < size; i++)
+      patch_jump(e, to_end[i]);
+    allocator_free(e->allocator, to_end, sizeof(size_t) * (size + 1));
+    return;
+  }
+  case N_CALL:
+  {
+    emit_node(e, node->call.fn, TAIL_NONE);
+    for (size_t i = 0; i < node->call.size; i++)
+      emit_node(e, node->call.args[i], TAIL_NONE);
+    emit_op(e, tail == TAIL_RETURN ? OP_TAIL_CALL : OP_CALL, -(int)node->call.size);
+    emit(e, node->call.size);
+    return;
+  }
+  case N_DEF:
+  case N_DEFN:
+    exitWithError("unexpected top special form in exp");
+  }
+  exitWithError("unknown node");
+}
+
+// an emitter buffer that was never grown is null, which memcpy must not be given even for no bytes
+static void *arena_copy(arena_t *arena, const void *src, size_t size)
+{
+  void *dst = arena_alloc(arena, size);
+  if (size > 0)
+    memcpy(dst, src, size);
+  return dst;
+}
+
+const bytecode_t *bytecode_compile(arena_t *arena, const node_t *node, int frame_size)
+{
+  // the emitter's buffers are temporary, the code is copied into arena when done
+  emitter_t e = {.allocator = arena->allocator};
+  emit_node(&e, node, TAIL_RETURN);
+  emit_op(&e, OP_RETURN, -1);
+  assert(e.depth == 0 && "unbalanced operand stack");
+  bytecode_t *code = arena_alloc(arena, sizeof(bytecode_t));
+  int32_t *words = arena_copy(arena, e.code, sizeof(int32_t) * e.size);
+  double *f64s = arena_copy(arena, e.f64s, sizeof(double) * e.f64_size);
+  // like the tables, the forms live as long as the nodes
+  const form_t **forms = arena_copy(arena, e.forms, sizeof(form_t *) * e.form_size);
+  // the tables live with the nodes, which are allocated alongside the code
+  const switch_table_t **tables = arena_copy(arena, e.tables, sizeof(switch_table_t *) * e.table_size);
+  *code = (bytecode_t){.frame_size = frame_size, .max_stack = e.max_depth, .code = words, .f64s = f64s, .forms = forms, .tables = tables};
+  allocator_free(e.allocator, e.code, sizeof(int32_t) * e.capacity);
+  allocator_free(e.allocator, e.f64s, sizeof(double) * e.f64_capacity);
+  allocator_free(e.allocator, e.forms, sizeof(form_t *) * e.form_capacity);
+  allocator_free(e.allocator, e.tables, sizeof(switch_table_t *) * e.table_capacity);
+  return code;
+}
+
+typedef struct
+{
+  const bytecode_t *code;
+  const int32_t *pc;
+  rtval_t *base;
+} call_frame_t;
+
+struct vm
+{
+  const allocator_t *allocator;
+  rtval_t *stack;
+  // end of the values in use, set before the vm allocates and reset when it returns
+  rtval_t *top;
+  call_frame_t *calls;
+};
+
+vm_t *vm_create(const allocator_t *allocator)
+{
+  vm_t *vm = allocator_alloc(allocator, sizeof(vm_t));
+  vm->allocator = allocator;
+  vm->stack = allocator_alloc(allocator, sizeof(rtval_t) * VM_STACK_SIZE);
+  vm->top = vm->stack;
+  vm->calls = allocator_alloc(allocator, sizeof(call_frame_t) * VM_MAX_CALL_DEPTH);
+  return vm;
+}
+
+void vm_live_values(const vm_t *vm, const rtval_t **start, const rtval_t **end)
+{
+  *start = vm->stack;
+  *end = vm->top;
+}
+
+// locals are set by the code before they are read, but the collector may scan them earlier
+static void clear_slots(rtval_t *start, rtval_t *end)
+{
+  for (rtval_t *slot = start; slot < end; slot++)
+    *slot = rtval_make_undefined();
+}
+
+void vm_free(vm_t *vm)
+{
+  if (vm == nullptr)
+    return;
+  const allocator_t *allocator = vm->allocator;
+  allocator_free(allocator, vm->stack, sizeof(rtval_t) * VM_STACK_SIZE);
+  allocator_free(allocator, vm->calls, sizeof(call_frame_t) * VM_MAX_CALL_DEPTH);
+  allocator_free(allocator, vm, sizeof(vm_t));
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO
+#endif
+
+rtval_t vm_run(vm_t *vm, def_env_t *denv, const bytecode_t *code)
+{
+  const rtval_t *stack_end = vm->stack + VM_STACK_SIZE;
+  const call_frame_t *calls_end = vm->calls + VM_MAX_CALL_DEPTH;
+  // globals are only defined between top-level forms, so the bindings do not move while running
+  const binding_t *globals = denv->bindings;
+  call_frame_t *call = vm->calls;
+  // a tail call moves the function into the slot below the frame, so leave one free
+  rtval_t *base = vm->stack + 1;
+  bool tail_call = false;
+  check_exit(base + code->frame_size + code->max_stack <= stack_end, "stack overflow");
+  rtval_t *sp = base + code->frame_size;
+  clear_slots(vm->stack, sp);
+  const int32_t *pc = code->code;
+
+#ifdef VM_COMPUTED_GOTO
+  static const void *labels[OP_COUNT] = {
+#define X(name, ...) [OP_##name] = &&op_##name,
+      FOR_EACH_OP(X)
+      FOR_EACH_I32_INTRINSIC(X)
+      FOR_EACH_F64_ARITH_INTRINSIC(X)
+      FOR_EACH_F64_CMP_INTRINSIC(X)
+#undef X
+#define X(name, ...) [OP_##name##_UNCHECKED] = &&op_##name##_UNCHECKED,
+      FOR_EACH_I32_INTRINSIC(X)
+      FOR_EACH_F64_ARITH_INTRINSIC(X)
+      FOR_EACH_F64_CMP_INTRINSIC(X)
+#undef X
+  };
+#define DISPATCH() goto *labels[*pc++]
+#define CASE(name) op_##name:
+  DISPATCH();
+#else
+#define DISPATCH() continue
+#define CASE(name) case OP_##name:
+  for (;;)
+    switch (*pc++)
+    {
+#endif
+
+  CASE(I32)
+  {
+    *sp++ = rtval_make_i32(*pc++);
+    DISPATCH();
+  }
+  CASE(F64)
+  {
+    *sp++ = rtval_make_f64(code->f64s[*pc++]);
+    DISPATCH();
+  }
+  CASE(FORM)
+  {
+    *sp++ = rtval_make_form(code->forms[*pc++]);
+    DISPATCH();
+  }
+  CASE(UNDEFINED)
+  {
+    *sp++ = rtval_make_undefined();
+    DISPATCH();
+  }
+  CASE(LOCAL)
+  {
+    *sp++ = base[*pc++];
+    DISPATCH();
+  }
+  CASE(GLOBAL)
+  {
+    const rtval_t val = globals[*pc++].value;
+    check_exit(rtval_get_tag(val) != rtval_undefined, "word not found in env");
+    *sp++ = val;
+    DISPATCH();
+  }
+  CASE(SET_LOCAL)
+  {
+    base[*pc++] = *--sp;
+    DISPATCH();
+  }
+  CASE(POP)
+  {
+    sp--;
+    DISPATCH();
+  }
+  CASE(JUMP)
+  {
+    pc = code->code + *pc;
+    DISPATCH();
+  }
+  CASE(JUMP_IF_FALSE)
+  {
+    const rtval_t cond = *--sp;
+    check_exit(rtval_get_tag(cond) == rtval_i32, "if requires i32 condition");
+    pc = rtval_get_i32(cond) ? pc + 1 : code->code + *pc;
+    DISPATCH();
+  }
+  CASE(CASE)
+  {
+    const rtval_t case_val = *--sp;
+    const rtval_t value = sp[-1];
+    bool match = false;
+    if (rtval_get_tag(case_val) == rtval_get_tag(value))
+    {
+      if (rtval_get_tag(case_val) == rtval_i32)
+        match = rtval_get_i32(case_val) == rtval_get_i32(value);
+      else if (rtval_get_tag(case_val) == rtval_f64)
+        match = rtval_get_f64(case_val) == rtval_get_f64(value);
+    }
+    pc = match ? code->code + *pc : pc + 1;
+    DISPATCH();
+  }
+  CASE(SWITCH_TABLE)
+  {
+    const switch_table_t *table = code->tables[*pc];
+    const rtval_t value = *--sp;
+    // the case values are i32 literals, so other values go to the default
+    const int case_index = rtval_get_tag(value) == rtval_i32 ? switch_table_lookup(table, rtval_get_i32(value)) : -1;
+    // the default's target comes first
+    pc = code->code + pc[2 + case_index];
+    DISPATCH();
+  }
+  CASE(CONTINUE)
+  {
+    *sp++ = rtval_make_continue();
+    DISPATCH();
+  }
+  CASE(LOOP_END)
+  {
+    if (rtval_get_tag(sp[-1]) == rtval_continue)
+    {
+      sp--;
+      pc = code->code + *pc;
+    }
+    else
+    {
+      pc++;
+    }
+    DISPATCH();
+  }
+  CASE(CALL)
+  {
+    tail_call = false;
+    goto call;
+  }
+  CASE(TAIL_CALL)
+  {
+    // the current frame is done, slide the function and its arguments down over it
+    const int numOfArgs = *pc;
+    memmove(base - 1, sp - numOfArgs - 1, sizeof(rtval_t) * (numOfArgs + 1));
+    sp = base + numOfArgs;
+    tail_call = true;
+    goto call;
+  }
+call:
+  {
+    const int numOfArgs = *pc++;
+    rtval_t *callee = sp - numOfArgs - 1;
+    check_exit(rtval_get_tag(*callee) == rtval_func, "expected function");
+    rtfunc_t *func = rtval_get_func(*callee);
+    const int arity = func->arity;
+    check_exit(numOfArgs >= arity, "too few arguments");
+    if (denv->engine == ENGINE_JIT && numOfArgs == arity)
+    {
+      if (!func->jit_tried)
+      {
+        func->jit = jit_compile(denv->allocator, func, callee + 1);
+        func->jit_tried = true;
+      }
+      // with other argument tags than the native code was compiled for the vm runs the function
+      rtval_t result;
+      if (func->jit != nullptr && jit_call(func->jit, callee + 1, &result))
+      {
+        *callee = result;
+        sp = callee + 1;
+        if (tail_call)
+          goto ret;
+        DISPATCH();
+      }
+    }
+    if (func->code == nullptr)
+      func->code = bytecode_compile(&func->arena, func->body, func->frame_size);
+    // the arguments become the first slots of the callee's frame
+    rtval_t *callee_base = callee + 1;
+    check_exit(callee_base + func->code->frame_size + func->code->max_stack <= stack_end, "stack overflow");
+    if (func->rest_unread)
+    {
+      callee_base[arity] = rtval_make_undefined();
+    }
+    else if (func->has_rest)
+    {
+      const int numRest = numOfArgs - arity;
+      // the arguments are still on the stack if this collects
+      vm->top = sp;
+      rtval_list_t *rest = gc_alloc_list(denv, numRest);
+      memcpy(rest->values, callee_base + arity, sizeof(rtval_t) * numRest);
+      callee_base[arity] = rtval_make_list(rest);
+    }
+    else
+    {
+      check_exit(numOfArgs == arity, "too many arguments");
+    }
+    if (!tail_call)
+    {
+      check_exit(call + 1 < calls_end, "call stack overflow");
+      *call++ = (call_frame_t){.code = code, .pc = pc, .base = base};
+    }
+    code = func->code;
+    base = callee_base;
+    sp = base + code->frame_size;
+    clear_slots(base + arity + (func->has_rest ? 1 : 0), sp);
+    pc = code->code;
+    DISPATCH();
+  }
+  CASE(CHECK)
+  {
+    check_exit(rtval_get_tag(sp[-1]) == (rtval_tag)*pc++, "value does not have its annotated type");
+    DISPATCH();
+  }
+  CASE(RETURN)
+  ret:
+  {
+    const rtval_t result = sp[-1];
+    if (call == vm->calls)
+    {
+      vm->top = vm->stack;
+      return result;
+    }
+    // the result replaces the function value below the arguments
+    sp = base - 1;
+    *sp++ = result;
+    const call_frame_t *caller = --call;
+    code = caller->code;
+    pc = caller->pc;
+    base = caller->base;
+    DISPATCH();
+  }
+
+// the checked opcode falls through to the unchecked one
+#define X(name, expr)                                                                                                       \
+  CASE(name)                                                                                                                \
+  check_exit(rtval_get_tag(sp[-2]) == rtval_i32 && rtval_get_tag(sp[-1]) == rtval_i32, "intrinsic requires i32 arguments"); \
+  CASE(name##_UNCHECKED)                                                                                                    \
+  {                                                                                                                         \
+    const int32_t a = rtval_get_i32(sp[-2]);                                                                                \
+    const int32_t b = rtval_get_i32(sp[-1]);                                                                                \
+    sp--;                                                                                                                   \
+    sp[-1] = rtval_make_i32(expr);                                                                                          \
+    DISPATCH();                                                                                                             \
+  }
+  FOR_EACH_I32_INTRINSIC(X)
+#undef X
+
+#define X(name, expr)                                                                                                       \
+  CASE(name)                                                                                                                \
+  check_exit(rtval_get_tag(sp[-2]) == rtval_f64 && rtval_get_tag(sp[-1]) == rtval_f64, "intrinsic requires f64 arguments"); \
+  CASE(name##_UNCHECKED)                                                                                                    \
+  {                                                                                                                         \
+    const double a = rtval_get_f64(sp[-2]);                                                                                 \
+    const double b = rtval_get_f64(sp[-1]);                                                                                 \
+    sp--;                                                                                                                   \
+    sp[-1] = rtval_make_f64(expr);                                                                                          \
+    DISPATCH();                                                                                                             \
+  }
+  FOR_EACH_F64_ARITH_INTRINSIC(X)
+#undef X
+
+#define X(name, expr)                                                                                                       \
+  CASE(name)                                                                                                                \
+  check_exit(rtval_get_tag(sp[-2]) == rtval_f64 && rtval_get_tag(sp[-1]) == rtval_f64, "intrinsic requires f64 arguments"); \
+  CASE(name##_UNCHECKED)                                                                                                    \
+  {                                                                                                                         \
+    const double a = rtval_get_f64(sp[-2]);                                                                                 \
+    const double b = rtval_get_f64(sp[-1]);                                                                                 \
+    sp--;                                                                                                                   \
+    sp[-1] = rtval_make_i32(expr);                                                                                          \
+    DISPATCH();                                                                                                             \
+  }
+  FOR_EACH_F64_CMP_INTRINSIC(X)
+#undef X
+
+#ifndef VM_COMPUTED_GOTO
+    default:
+      exitWithError("unknown opcode");
+    }
+#endif
+#undef DISPATCH
+#undef CASE
+  exit(1);
+}
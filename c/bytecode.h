@@ -0,0 +1,107 @@
+#pragma once
+
+#include "compile.h"
+
+// the intrinsics, each is its own opcode so the vm does not dispatch twice
+#define FOR_EACH_I32_INTRINSIC(X)                       \
+  X(I32_ADD, a + b)                                     \
+  X(I32_SUB, a - b)                                     \
+  X(I32_MUL, a * b)                                     \
+  X(I32_DIV_S, a / b)                                   \
+  X(I32_REM_S, a % b)                                   \
+  X(I32_EQ, a == b)                                     \
+  X(I32_NE, a != b)                                     \
+  X(I32_LT_S, a < b)                                    \
+  X(I32_GT_S, a > b)                                    \
+  X(I32_LE_S, a <= b)                                   \
+  X(I32_GE_S, a >= b)                                   \
+  X(I32_AND, a & b)                                     \
+  X(I32_OR, a | b)                                      \
+  X(I32_XOR, a ^ b)                                     \
+  X(I32_SHL, a << b)                                    \
+  X(I32_SHR_S, a >> b)                                  \
+  X(I32_SHR_U, (unsigned)a >> (unsigned)b)
+
+#define FOR_EACH_F64_ARITH_INTRINSIC(X) \
+  X(F64_ADD, a + b)                     \
+  X(F64_SUB, a - b)                     \
+  X(F64_MUL, a * b)                     \
+  X(F64_DIV, a / b)
+
+#define FOR_EACH_F64_CMP_INTRINSIC(X) \
+  X(F64_EQ, a == b)                   \
+  X(F64_NE, a != b)                   \
+  X(F64_LT, a < b)                    \
+  X(F64_GT, a > b)                    \
+  X(F64_LE, a <= b)                   \
+  X(F64_GE, a >= b)
+
+// operands follow the opcode in the code stream:
+// I32 value, F64 index into f64s, FORM index into forms, LOCAL GLOBAL SET_LOCAL slot, CALL TAIL_CALL number of arguments
+// JUMP JUMP_IF_FALSE target, CASE target taken if the popped value equals the switch value below it
+// LOOP_END target taken if the loop body evaluated to a continue
+// CONTINUE pushes a continue, only used when not in tail position of its loop
+// SWITCH_TABLE index into tables, the default's target, then a target per case, pops the switch value
+// TAIL_CALL replaces the current frame with the callee's instead of returning to it
+// CHECK the tag the value on top must have
+// every intrinsic also has an _UNCHECKED opcode for operands the compiler proved to have its argument type
+#define FOR_EACH_OP(X) \
+  X(I32)               \
+  X(F64)               \
+  X(FORM)              \
+  X(UNDEFINED)         \
+  X(LOCAL)             \
+  X(GLOBAL)            \
+  X(SET_LOCAL)         \
+  X(POP)               \
+  X(JUMP)              \
+  X(JUMP_IF_FALSE)     \
+  X(CASE)              \
+  X(SWITCH_TABLE)       \
+  X(CONTINUE)          \
+  X(LOOP_END)          \
+  X(CALL)              \
+  X(TAIL_CALL)         \
+  X(RETURN)            \
+  X(CHECK)
+
+typedef enum
+{
+#define X(name, ...) OP_##name,
+  FOR_EACH_OP(X)
+  FOR_EACH_I32_INTRINSIC(X)
+  FOR_EACH_F64_ARITH_INTRINSIC(X)
+  FOR_EACH_F64_CMP_INTRINSIC(X)
+#undef X
+#define X(name, ...) OP_##name##_UNCHECKED,
+  FOR_EACH_I32_INTRINSIC(X)
+  FOR_EACH_F64_ARITH_INTRINSIC(X)
+  FOR_EACH_F64_CMP_INTRINSIC(X)
+#undef X
+  OP_COUNT
+} opcode_t;
+
+typedef struct bytecode
+{
+  // local slots, the operand stack starts after them
+  int frame_size;
+  // deepest the operand stack gets
+  int max_stack;
+  const int32_t *code;
+  const double *f64s;
+  const form_t *const *forms;
+  const switch_table_t *const *tables;
+} bytecode_t;
+
+// compile the body of a function or a top-level form, allocated in arena
+const bytecode_t *bytecode_compile(arena_t *arena, const node_t *node, int frame_size);
+
+typedef struct vm vm_t;
+
+// the stacks come from allocator, nullptr for malloc
+vm_t *vm_create(const allocator_t *allocator);
+void vm_free(vm_t *vm);
+// the values on the vm's stack, roots for the collector
+void vm_live_values(const vm_t *vm, const rtval_t **start, const rtval_t **end);
+// run the code of a top-level form, functions are compiled on their first call
+rtval_t vm_run(vm_t *vm, def_env_t *denv, const bytecode_t *code);
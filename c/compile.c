@@ -0,0 +1,1032 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include "compile.h"
+
+#define INIT_SCOPE_CAPACITY 16
+#define INIT_EXPANSIONS_CAPACITY 16
+// dense switch tables may have up to this many slots per case value
+#define SWITCH_TABLE_MAX_SPREAD 4
+
+static const word_t *try_get_word(const form_t *form)
+{
+  if (form->type != T_WORD)
+    return nullptr;
+  return form->word;
+}
+
+static const word_t *get_word(const form_t *form)
+{
+  check_exit(form->type == T_WORD, "expected word");
+  return form->word;
+}
+
+static const form_list_t *get_list(const form_t *form)
+{
+  check_exit(form->type == T_LIST, "expected list");
+  return form->list;
+}
+
+static int32_t parse_i32(const char *word)
+{
+  char *endptr;
+  errno = 0;
+  const long result = strtol(word, &endptr, 10);
+  if (errno != 0)
+  {
+    perror("strtol");
+    exitWithError("non-integer argument for 'i32'");
+  }
+  check_exit(*endptr == '\0', "non-integer argument for 'i32'");
+  check_exit(result >= INT32_MIN && result <= INT32_MAX, "integer out of range for 'i32'");
+  return (int32_t)result;
+}
+
+static double parse_f64(const char *word)
+{
+  char *endptr;
+  errno = 0;
+  const double result = strtod(word, &endptr);
+  if (errno != 0)
+  {
+    perror("strtod");
+    exitWithError("non-float argument for 'f64'");
+  }
+  check_exit(*endptr == '\0', "non-float argument for 'f64'");
+  return result;
+}
+
+typedef enum
+{
+  SF_I32,
+  SF_F64,
+  SF_WORD,
+  SF_INTRINSIC,
+  SF_IF,
+  SF_DO,
+  SF_LET,
+  SF_LETFN,
+  SF_TYPE_ANNO,
+  SF_LOOP,
+  SF_CONTINUE,
+  SF_SWITCH,
+  SF_FUNC,
+  SF_DEF,
+  SF_DEFN,
+  SF_DEFEXPR,
+  SF_DEFMACRO,
+  SF_LOAD,
+  SF_TYPE,
+  SF_IMPORT,
+  SF_EXPORT
+} special_form_type_t;
+
+typedef struct special_form
+{
+  char *name;
+  special_form_type_t type;
+} special_form_t;
+
+
+typedef struct intrinsic
+{
+  char *name;
+  intrinsic_type_t type;
+} intrinsic_t;
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wmissing-field-initializers"
+#include "special_forms.h"
+
+#include "intrinsics.h"
+#pragma clang diagnostic pop
+
+int32_t eval_i32_bin_intrinsic(intrinsic_type_t t, int32_t a, int32_t b)
+{
+  switch (t)
+  {
+  case INTRINSIC_I32_ADD:
+    return a + b;
+  case INTRINSIC_I32_SUB:
+    return a - b;
+  case INTRINSIC_I32_MUL:
+    return a * b;
+  case INTRINSIC_I32_DIV_S:
+    return a / b;
+  case INTRINSIC_I32_REM_S:
+    return a % b;
+
+  case INTRINSIC_I32_EQ:
+    return a == b;
+  case INTRINSIC_I32_NE:
+    return a != b;
+  case INTRINSIC_I32_LT_S:
+    return a < b;
+  case INTRINSIC_I32_GT_S:
+    return a > b;
+  case INTRINSIC_I32_LE_S:
+    return a <= b;
+  case INTRINSIC_I32_GE_S:
+    return a >= b;
+
+  case INTRINSIC_I32_AND:
+    return a & b;
+  case INTRINSIC_I32_OR:
+    return a | b;
+  case INTRINSIC_I32_XOR:
+    return a ^ b;
+  case INTRINSIC_I32_SHL:
+    return a << b;
+  case INTRINSIC_I32_SHR_S:
+    return a >> b;
+  case INTRINSIC_I32_SHR_U:
+    return (unsigned)a >> (unsigned)b;
+  default:
+    break;
+  }
+  printf("Error: unknown intrinsic type\n");
+  exit(1);
+}
+
+double eval_f64_bin_arith_intrinsic(intrinsic_type_t t, double a, double b)
+{
+  switch (t)
+  {
+  case INTRINSIC_F64_ADD:
+    return a + b;
+  case INTRINSIC_F64_SUB:
+    return a - b;
+  case INTRINSIC_F64_MUL:
+    return a * b;
+  case INTRINSIC_F64_DIV:
+    return a / b;
+  default:
+    break;
+  }
+  printf("Error: unknown intrinsic type\n");
+  exit(1);
+}
+
+bool eval_f64_bin_cmp_intrinsic(intrinsic_type_t t, double a, double b)
+{
+  switch (t)
+  {
+  case INTRINSIC_F64_EQ:
+    return a == b;
+  case INTRINSIC_F64_NE:
+    return a != b;
+  case INTRINSIC_F64_LT:
+    return a < b;
+  case INTRINSIC_F64_GT:
+    return a > b;
+  case INTRINSIC_F64_LE:
+    return a <= b;
+  case INTRINSIC_F64_GE:
+    return a >= b;
+  default:
+    break;
+  }
+  printf("Error: unknown intrinsic type\n");
+  exit(1);
+}
+
+intrinsic_kind_t intrinsic_kind(intrinsic_type_t t)
+{
+  switch (t)
+  {
+  case INTRINSIC_F64_ADD:
+  case INTRINSIC_F64_SUB:
+  case INTRINSIC_F64_MUL:
+  case INTRINSIC_F64_DIV:
+    return INTRINSIC_KIND_F64_ARITH;
+  case INTRINSIC_F64_EQ:
+  case INTRINSIC_F64_NE:
+  case INTRINSIC_F64_LT:
+  case INTRINSIC_F64_GT:
+  case INTRINSIC_F64_LE:
+  case INTRINSIC_F64_GE:
+    return INTRINSIC_KIND_F64_CMP;
+  default:
+    return INTRINSIC_KIND_I32;
+  }
+}
+
+static const node_t *node_alloc(arena_t *arena, node_t node)
+{
+  node_t *n = arena_alloc(arena, sizeof(node_t));
+  *n = node;
+  return n;
+}
+
+typedef struct
+{
+  const word_t *var;
+  int slot;
+  value_type_t type;
+} scope_entry_t;
+
+// a macro call and the form it expanded to
+typedef struct
+{
+  const form_t *call;
+  const form_t *expansion;
+} expansion_t;
+
+// locals in scope while compiling a function body or a top-level form
+typedef struct
+{
+  arena_t *arena;
+  def_env_t *denv;
+  size_t size;
+  size_t capacity;
+  scope_entry_t *entries;
+  // entries [loop_start, loop_end) are the bindings of the innermost loop
+  size_t loop_start;
+  size_t loop_end;
+  // the innermost loop, allocated before its body is compiled
+  node_t *loop;
+  // a continue of the innermost loop gave one of its variables a value of another type
+  // than the loop started with, so the body is compiled again with the variable untyped
+  bool loop_widened;
+  int next_slot;
+  int frame_size;
+  // open addressing table of the macro calls expanded so far keyed by their form, so a form
+  // compiled again, like a loop body whose variables were widened, does not run the macro again
+  size_t expansions_size;
+  size_t expansions_capacity;
+  expansion_t *expansions;
+} compiler_t;
+
+static void compiler_free(compiler_t *c)
+{
+  allocator_free(c->denv->allocator, c->entries, sizeof(scope_entry_t) * c->capacity);
+  allocator_free(c->denv->allocator, c->expansions, sizeof(expansion_t) * c->expansions_capacity);
+}
+
+static int scope_push(compiler_t *c, const word_t *var, value_type_t type)
+{
+  if (c->size == c->capacity)
+  {
+    const size_t old_capacity = c->capacity;
+    c->capacity = old_capacity ? old_capacity * 2 : INIT_SCOPE_CAPACITY;
+    c->entries = allocator_realloc(c->denv->allocator, c->entries, sizeof(scope_entry_t) * old_capacity,
+                                   sizeof(scope_entry_t) * c->capacity);
+  }
+  const int slot = c->next_slot++;
+  if (c->next_slot > c->frame_size)
+    c->frame_size = c->next_slot;
+  c->entries[c->size++] = (scope_entry_t){.var = var, .slot = slot, .type = type};
+  return slot;
+}
+
+// search from the innermost binding so later bindings shadow earlier ones, returns the entry's index
+static int scope_find(const compiler_t *c, size_t start, size_t end, const word_t *var)
+{
+  for (size_t i = end; i-- > start;)
+  {
+    if (word_eq(c->entries[i].var, var))
+      return i;
+  }
+  return -1;
+}
+
+// the slot of the macro word is bound to, -1 if it is not bound to one
+static int macro_slot(const def_env_t *denv, const word_t *word)
+{
+  if (word->id >= denv->word_slots_capacity || denv->word_slots[word->id] == 0)
+    return -1;
+  const int slot = denv->word_slots[word->id] - 1;
+  const rtval_t value = denv->bindings[slot].value;
+  return rtval_get_tag(value) == rtval_func && rtval_get_func(value)->is_macro ? slot : -1;
+}
+
+static const node_t *compile_var(compiler_t *c, const word_t *var)
+{
+  const int index = scope_find(c, 0, c->size, var);
+  if (index >= 0)
+  {
+    const scope_entry_t *entry = &c->entries[index];
+    return node_alloc(c->arena, (node_t){.kind = N_LOCAL, .type = entry->type, .slot = entry->slot});
+  }
+  check_exit(macro_slot(c->denv, var) < 0, "macro in value position");
+  return node_alloc(c->arena, (node_t){.kind = N_GLOBAL, .slot = def_env_slot(c->denv, var)});
+}
+
+// the slot of the macro a top-level form calls, -1 if it is not a macro call
+static int top_macro_slot(const def_env_t *denv, const form_t *form)
+{
+  if (form->type != T_LIST || form->list->size == 0)
+    return -1;
+  const word_t *name = try_get_word(form->list->cells[0]);
+  return name ? macro_slot(denv, name) : -1;
+}
+
+// the result of a macro as a form, lists of forms are made list forms
+static const form_t *value_to_form(arena_t *arena, rtval_t value)
+{
+  switch (rtval_get_tag(value))
+  {
+  case rtval_form:
+    return rtval_get_form(value);
+  case rtval_list:
+  {
+    const rtval_list_t *values = rtval_get_list(value);
+    form_list_t *list = arena_alloc(arena, sizeof(form_list_t) + sizeof(form_t *) * values->size);
+    list->size = values->size;
+    for (size_t i = 0; i < values->size; i++)
+      list->cells[i] = value_to_form(arena, values->values[i]);
+    form_t *form = arena_alloc(arena, sizeof(form_t));
+    *form = (form_t){.type = T_LIST, .list = list};
+    return form;
+  }
+  default:
+    exitWithError("macro must return a form or a list of forms");
+  }
+  exit(1);
+}
+
+// call the macro in slot with the argument forms of call, the expansion is allocated in
+// the scratch arena as it is only needed while the top-level form is compiled
+static const form_t *run_macro(def_env_t *denv, const form_t *call, int slot)
+{
+  arena_t *arena = &denv->scratch;
+  const form_list_t *list = call->list;
+  const size_t size = list->size - 1;
+  const node_t **args = arena_alloc(arena, sizeof(node_t *) * size);
+  for (size_t i = 0; i < size; i++)
+    args[i] = node_alloc(arena, (node_t){.kind = N_FORM, .form = list->cells[i + 1]});
+  const node_t *fn = node_alloc(arena, (node_t){.kind = N_GLOBAL, .slot = slot});
+  const node_t *node = node_alloc(arena, (node_t){.kind = N_CALL, .call = {.fn = fn, .size = size, .args = args}});
+  return value_to_form(arena, eval_tree(denv, node, 0));
+}
+
+static size_t expansion_index(const expansion_t *expansions, size_t capacity, const form_t *call)
+{
+  size_t i = (((uintptr_t)call >> 4) * 0x9E3779B97F4A7C15ull) & (capacity - 1);
+  while (expansions[i].call != nullptr && expansions[i].call != call)
+    i = (i + 1) & (capacity - 1);
+  return i;
+}
+
+static const form_t *expand_macro(compiler_t *c, const form_t *call, int slot)
+{
+  if (c->expansions_capacity > 0)
+  {
+    const expansion_t *cached = &c->expansions[expansion_index(c->expansions, c->expansions_capacity, call)];
+    if (cached->call != nullptr)
+      return cached->expansion;
+  }
+  const form_t *expansion = run_macro(c->denv, call, slot);
+  if (2 * (c->expansions_size + 1) > c->expansions_capacity)
+  {
+    const size_t capacity = c->expansions_capacity ? c->expansions_capacity * 2 : INIT_EXPANSIONS_CAPACITY;
+    expansion_t *expansions = allocator_alloc(c->denv->allocator, sizeof(expansion_t) * capacity);
+    memset(expansions, 0, sizeof(expansion_t) * capacity);
+    for (size_t i = 0; i < c->expansions_capacity; i++)
+    {
+      if (c->expansions[i].call != nullptr)
+        expansions[expansion_index(expansions, capacity, c->expansions[i].call)] = c->expansions[i];
+    }
+    allocator_free(c->denv->allocator, c->expansions, sizeof(expansion_t) * c->expansions_capacity);
+    c->expansions = expansions;
+    c->expansions_capacity = capacity;
+  }
+  c->expansions[expansion_index(c->expansions, c->expansions_capacity, call)] = (expansion_t){.call = call, .expansion = expansion};
+  c->expansions_size++;
+  return expansion;
+}
+
+// loop_tail is true when the value of the form is the value of the innermost loop body
+static const node_t *compile_node(compiler_t *c, const form_t *form, bool loop_tail);
+
+// the folding below is done as nodes are built, so every engine sees the simpler nodes
+// it only removes work that cannot fail or have an effect, runtime errors stay where they were
+
+static bool is_literal(const node_t *node)
+{
+  return node->kind == N_I32 || node->kind == N_F64;
+}
+
+// evaluating the node can be skipped when its value is not used
+static bool is_pure(const node_t *node)
+{
+  return is_literal(node) || node->kind == N_FORM || node->kind == N_LOCAL;
+}
+
+// an intrinsic over literals of its argument type is evaluated now, except for the divisions that trap
+static const node_t *fold_intrinsic(arena_t *arena, intrinsic_type_t op, const node_t *a, const node_t *b)
+{
+  switch (intrinsic_kind(op))
+  {
+  case INTRINSIC_KIND_I32:
+    if (a->kind != N_I32 || b->kind != N_I32)
+      return nullptr;
+    if ((op == INTRINSIC_I32_DIV_S || op == INTRINSIC_I32_REM_S) && (b->i32 == 0 || (a->i32 == INT32_MIN && b->i32 == -1)))
+      return nullptr;
+    return node_alloc(arena, (node_t){.kind = N_I32, .type = TYPE_I32, .i32 = eval_i32_bin_intrinsic(op, a->i32, b->i32)});
+  case INTRINSIC_KIND_F64_ARITH:
+    if (a->kind != N_F64 || b->kind != N_F64)
+      return nullptr;
+    return node_alloc(arena, (node_t){.kind = N_F64, .type = TYPE_F64, .f64 = eval_f64_bin_arith_intrinsic(op, a->f64, b->f64)});
+  case INTRINSIC_KIND_F64_CMP:
+    if (a->kind != N_F64 || b->kind != N_F64)
+      return nullptr;
+    return node_alloc(arena, (node_t){.kind = N_I32, .type = TYPE_I32, .i32 = eval_f64_bin_cmp_intrinsic(op, a->f64, b->f64)});
+  }
+  return nullptr;
+}
+
+// the body a switch on a literal takes, nullptr unless the case values up to the match are literals
+static const node_t *fold_switch(const node_t *value, size_t size, const switch_case_t *cases, const node_t *default_case)
+{
+  if (!is_literal(value))
+    return nullptr;
+  for (size_t i = 0; i < size; i++)
+  {
+    for (size_t j = 0; j < cases[i].size; j++)
+    {
+      const node_t *case_value = cases[i].values[j];
+      if (!is_literal(case_value))
+        return nullptr;
+      if (case_value->kind != value->kind)
+        continue;
+      if (value->kind == N_I32 ? case_value->i32 == value->i32 : case_value->f64 == value->f64)
+        return cases[i].body;
+    }
+  }
+  return default_case;
+}
+
+// compile cells [start, list->size) of a list into a sequence, dropping values that are not used
+// and need no evaluation, a sequence of one is just that node
+static const node_t *compile_seq(compiler_t *c, const form_list_t *list, size_t start, bool loop_tail)
+{
+  const size_t size = list->size - start;
+  const node_t **exps = arena_alloc(c->arena, sizeof(node_t *) * size);
+  size_t kept = 0;
+  for (size_t i = 0; i < size; i++)
+  {
+    const node_t *exp = compile_node(c, list->cells[start + i], loop_tail && i == size - 1);
+    if (i < size - 1 && is_pure(exp))
+      continue;
+    exps[kept++] = exp;
+  }
+  if (kept == 1)
+    return exps[0];
+  const value_type_t type = kept > 0 ? exps[kept - 1]->type : TYPE_ANY;
+  return node_alloc(c->arena, (node_t){.kind = N_DO, .type = type, .seq = {.size = kept, .exps = exps}});
+}
+
+// a continue in tail position jumps instead of producing a value
+static bool is_jump(const node_t *node)
+{
+  return node->kind == N_CONTINUE && node->cont.loop != nullptr;
+}
+
+// the type of a node that evaluates to either a or b
+static value_type_t join_types(const node_t *a, const node_t *b)
+{
+  if (is_jump(a))
+    return b->type;
+  if (is_jump(b))
+    return a->type;
+  return a->type == b->type ? a->type : TYPE_ANY;
+}
+
+// i32 and f64 are checked, other type forms are not known to the runtime
+static value_type_t parse_type(const form_t *form)
+{
+  const word_t *word = try_get_word(form);
+  if (word == nullptr)
+    return TYPE_ANY;
+  if (strcmp(word->chars, "i32") == 0)
+    return TYPE_I32;
+  if (strcmp(word->chars, "f64") == 0)
+    return TYPE_F64;
+  return TYPE_ANY;
+}
+
+// let and loop share their shape, a binding list followed by the body
+static const node_t *compile_let(compiler_t *c, node_kind_t kind, const form_list_t *list, bool loop_tail)
+{
+  check_exit(list->size >= 2, "let requires at least two arguments");
+  const form_list_t *bindingForms = get_list(list->cells[1]);
+  check_exit(bindingForms->size % 2 == 0, "let bindings must be a list of even length");
+  const size_t number_of_bindings = bindingForms->size / 2;
+  node_binding_t *bindings = arena_alloc(c->arena, sizeof(node_binding_t) * number_of_bindings);
+  const size_t outer_size = c->size;
+  const int outer_next_slot = c->next_slot;
+  for (size_t i = 0; i < number_of_bindings; i++)
+  {
+    const word_t *var = get_word(bindingForms->cells[i * 2]);
+    bindings[i].value = compile_node(c, bindingForms->cells[i * 2 + 1], false);
+    bindings[i].slot = scope_push(c, var, bindings[i].value->type);
+  }
+  const size_t outer_loop_start = c->loop_start;
+  const size_t outer_loop_end = c->loop_end;
+  node_t *outer_loop = c->loop;
+  const bool outer_loop_widened = c->loop_widened;
+  node_t *loop = nullptr;
+  if (kind == N_LOOP)
+  {
+    // continues in the body refer to the loop node
+    loop = arena_alloc(c->arena, sizeof(node_t));
+    loop->kind = N_LOOP;
+    c->loop_start = outer_size;
+    c->loop_end = c->size;
+    c->loop = loop;
+  }
+  const node_t *body;
+  do
+  {
+    if (loop)
+    {
+      loop->let.jump_continues = true;
+      c->loop_widened = false;
+    }
+    body = compile_seq(c, list, 2, loop ? true : loop_tail);
+  } while (loop && c->loop_widened);
+  c->loop_start = outer_loop_start;
+  c->loop_end = outer_loop_end;
+  c->loop = outer_loop;
+  c->loop_widened = outer_loop_widened;
+  // slots are free again once the body is done
+  c->size = outer_size;
+  c->next_slot = outer_next_slot;
+  if (loop)
+  {
+    // a loop that is not left by jumping may evaluate to a continue
+    loop->type = loop->let.jump_continues ? body->type : TYPE_ANY;
+    loop->let.size = number_of_bindings;
+    loop->let.bindings = bindings;
+    loop->let.body = body;
+    return loop;
+  }
+  if (number_of_bindings == 0)
+    return body;
+  return node_alloc(c->arena, (node_t){.kind = kind, .type = body->type, .let = {.size = number_of_bindings, .bindings = bindings, .body = body}});
+}
+
+typedef struct
+{
+  int32_t key;
+  int32_t case_index;
+} switch_entry_t;
+
+static int compare_switch_entries(const void *a, const void *b)
+{
+  const switch_entry_t *x = a;
+  const switch_entry_t *y = b;
+  if (x->key != y->key)
+    return x->key < y->key ? -1 : 1;
+  // the first case with a value wins
+  return x->case_index - y->case_index;
+}
+
+static const switch_table_t *compile_switch_table(arena_t *arena, const switch_case_t *cases, size_t size)
+{
+  size_t number_of_keys = 0;
+  for (size_t i = 0; i < size; i++)
+  {
+    for (size_t j = 0; j < cases[i].size; j++)
+    {
+      if (cases[i].values[j]->kind != N_I32)
+        return nullptr;
+      number_of_keys++;
+    }
+  }
+  if (number_of_keys == 0)
+    return nullptr;
+  const size_t entries_size = sizeof(switch_entry_t) * number_of_keys;
+  switch_entry_t *entries = allocator_alloc(arena->allocator, entries_size);
+  size_t n = 0;
+  for (size_t i = 0; i < size; i++)
+    for (size_t j = 0; j < cases[i].size; j++)
+      entries[n++] = (switch_entry_t){.key = cases[i].values[j]->i32, .case_index = i};
+  qsort(entries, number_of_keys, sizeof(switch_entry_t), compare_switch_entries);
+  // drop keys shadowed by an earlier case
+  n = 1;
+  for (size_t i = 1; i < number_of_keys; i++)
+  {
+    if (entries[i].key != entries[n - 1].key)
+      entries[n++] = entries[i];
+  }
+  number_of_keys = n;
+  switch_table_t *table = arena_alloc(arena, sizeof(switch_table_t));
+  const int32_t min = entries[0].key;
+  const int64_t range = (int64_t)entries[number_of_keys - 1].key - min + 1;
+  if (range <= (int64_t)number_of_keys * SWITCH_TABLE_MAX_SPREAD)
+  {
+    int32_t *table_cases = arena_alloc(arena, sizeof(int32_t) * range);
+    for (int64_t i = 0; i < range; i++)
+      table_cases[i] = -1;
+    for (size_t i = 0; i < number_of_keys; i++)
+      table_cases[entries[i].key - min] = entries[i].case_index;
+    *table = (switch_table_t){.dense = true, .min = min, .size = range, .cases = table_cases};
+  }
+  else
+  {
+    int32_t *keys = arena_alloc(arena, sizeof(int32_t) * number_of_keys);
+    int32_t *table_cases = arena_alloc(arena, sizeof(int32_t) * number_of_keys);
+    for (size_t i = 0; i < number_of_keys; i++)
+    {
+      keys[i] = entries[i].key;
+      table_cases[i] = entries[i].case_index;
+    }
+    *table = (switch_table_t){.dense = false, .min = min, .size = number_of_keys, .keys = keys, .cases = table_cases};
+  }
+  allocator_free(arena->allocator, entries, entries_size);
+  return table;
+}
+
+int switch_table_lookup(const switch_table_t *table, int32_t value)
+{
+  if (table->dense)
+  {
+    const uint32_t index = (uint32_t)value - (uint32_t)table->min;
+    return index < table->size ? table->cases[index] : -1;
+  }
+  size_t low = 0;
+  size_t high = table->size;
+  while (low < high)
+  {
+    const size_t mid = low + (high - low) / 2;
+    if (table->keys[mid] < value)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low < table->size && table->keys[low] == value ? table->cases[low] : -1;
+}
+
+static const node_t *compile_node(compiler_t *c, const form_t *form, bool loop_tail)
+{
+  arena_t *arena = c->arena;
+  if (form->type == T_WORD)
+    return compile_var(c, form->word);
+
+  const form_list_t *list = form->list;
+  check_exit(list->size > 0, "empty list");
+  const word_t *name = try_get_word(list->cells[0]);
+  check_exit(name, "direct form application not implemented");
+  const struct special_form *spec = try_get_wuns_special_form(name->chars, name->size);
+  if (!spec)
+  {
+    // a local of the same name shadows a macro
+    const int macro = scope_find(c, 0, c->size, name) < 0 ? macro_slot(c->denv, name) : -1;
+    if (macro >= 0)
+      return compile_node(c, expand_macro(c, form, macro), loop_tail);
+    const node_t *fn = compile_var(c, name);
+    const size_t size = list->size - 1;
+    const node_t **args = arena_alloc(arena, sizeof(node_t *) * size);
+    for (size_t i = 0; i < size; i++)
+      args[i] = compile_node(c, list->cells[i + 1], false);
+    return node_alloc(arena, (node_t){.kind = N_CALL, .call = {.fn = fn, .size = size, .args = args}});
+  }
+  switch (spec->type)
+  {
+  case SF_I32:
+  {
+    check_exit(list->size == 2, "i32 requires exactly one argument");
+    const word_t *arg_word = get_word(list->cells[1]);
+    return node_alloc(arena, (node_t){.kind = N_I32, .type = TYPE_I32, .i32 = parse_i32(arg_word->chars)});
+  }
+  case SF_F64:
+  {
+    check_exit(list->size == 2, "f64 requires exactly one argument");
+    const word_t *arg_word = get_word(list->cells[1]);
+    return node_alloc(arena, (node_t){.kind = N_F64, .type = TYPE_F64, .f64 = parse_f64(arg_word->chars)});
+  }
+  case SF_INTRINSIC:
+  {
+    check_exit(list->size > 1, "intrinsic requires at least one argument");
+    const word_t *arg_word = get_word(list->cells[1]);
+    const struct intrinsic *intrinsic = try_get_wuns_intrinsic(arg_word->chars, arg_word->size);
+    check_exit(intrinsic, "unknown intrinsic");
+    check_exit(list->size == 4, "intrinsic requires exactly two arguments");
+    const node_t *a = compile_node(c, list->cells[2], false);
+    const node_t *b = compile_node(c, list->cells[3], false);
+    const node_t *folded = fold_intrinsic(arena, intrinsic->type, a, b);
+    if (folded != nullptr)
+      return folded;
+    const intrinsic_kind_t kind = intrinsic_kind(intrinsic->type);
+    const value_type_t arg_type = kind == INTRINSIC_KIND_I32 ? TYPE_I32 : TYPE_F64;
+    const value_type_t type = kind == INTRINSIC_KIND_F64_ARITH ? TYPE_F64 : TYPE_I32;
+    const bool proven = a->type == arg_type && b->type == arg_type;
+    return node_alloc(arena, (node_t){
+                                 .kind = proven ? N_INTRINSIC_UNCHECKED : N_INTRINSIC,
+                                 .type = type,
+                                 .intrinsic = {.op = intrinsic->type, .a = a, .b = b}});
+  }
+  case SF_IF:
+  {
+    check_exit(list->size == 4, "if requires exactly three arguments");
+    const node_t *cond = compile_node(c, list->cells[1], false);
+    const node_t *then = compile_node(c, list->cells[2], loop_tail);
+    const node_t *otherwise = compile_node(c, list->cells[3], loop_tail);
+    // a condition of another type is an error at runtime
+    if (cond->kind == N_I32)
+      return cond->i32 ? then : otherwise;
+    return node_alloc(arena, (node_t){.kind = N_IF, .type = join_types(then, otherwise), .if_ = {.cond = cond, .then = then, .otherwise = otherwise}});
+  }
+  case SF_DO:
+    return compile_seq(c, list, 1, loop_tail);
+  case SF_LET:
+    return compile_let(c, N_LET, list, loop_tail);
+  case SF_LOOP:
+    return compile_let(c, N_LOOP, list, loop_tail);
+  case SF_CONTINUE:
+  {
+    check_exit(c->loop, "continue not in loop");
+    check_exit(list->size % 2 != 0, "continue requires an even number of arguments");
+    const size_t size = list->size / 2;
+    node_binding_t *bindings = arena_alloc(arena, sizeof(node_binding_t) * size);
+    for (size_t i = 0; i < size; i++)
+    {
+      const int index = scope_find(c, c->loop_start, c->loop_end, get_word(list->cells[i * 2 + 1]));
+      check_exit(index >= 0, "continue: word not bound by loop");
+      bindings[i].value = compile_node(c, list->cells[i * 2 + 2], false);
+      scope_entry_t *entry = &c->entries[index];
+      bindings[i].slot = entry->slot;
+      if (entry->type != TYPE_ANY && entry->type != bindings[i].value->type)
+      {
+        entry->type = TYPE_ANY;
+        c->loop_widened = true;
+      }
+    }
+    if (!loop_tail)
+      c->loop->let.jump_continues = false;
+    return node_alloc(arena, (node_t){
+                                 .kind = N_CONTINUE,
+                                 .cont = {.size = size, .bindings = bindings, .loop = loop_tail ? c->loop : nullptr}});
+  }
+  case SF_SWITCH:
+  {
+    check_exit(list->size >= 3, "switch requires at least two arguments");
+    check_exit(list->size % 2 != 0, "switch requires an odd number of arguments");
+    const node_t *value = compile_node(c, list->cells[1], false);
+    const size_t size = (list->size - 3) / 2;
+    switch_case_t *cases = arena_alloc(arena, sizeof(switch_case_t) * size);
+    for (size_t i = 0; i < size; i++)
+    {
+      const form_list_t *case_values = get_list(list->cells[i * 2 + 2]);
+      const node_t **values = arena_alloc(arena, sizeof(node_t *) * case_values->size);
+      for (size_t j = 0; j < case_values->size; j++)
+        values[j] = compile_node(c, case_values->cells[j], false);
+      cases[i] = (switch_case_t){
+          .size = case_values->size,
+          .values = values,
+          .body = compile_node(c, list->cells[i * 2 + 3], loop_tail)};
+    }
+    const node_t *default_case = compile_node(c, list->cells[list->size - 1], loop_tail);
+    const node_t *taken = fold_switch(value, size, cases, default_case);
+    if (taken != nullptr)
+      return taken;
+    // the type the bodies that produce a value agree on
+    const node_t *typed = default_case;
+    bool agree = true;
+    for (size_t i = 0; i < size; i++)
+    {
+      const node_t *body = cases[i].body;
+      if (is_jump(typed))
+        typed = body;
+      else if (!is_jump(body) && body->type != typed->type)
+        agree = false;
+    }
+    return node_alloc(arena, (node_t){
+                                 .kind = N_SWITCH,
+                                 .type = agree ? typed->type : TYPE_ANY,
+                                 .switch_ = {
+                                     .value = value,
+                                     .size = size,
+                                     .cases = cases,
+                                     .default_case = default_case,
+                                     .table = compile_switch_table(arena, cases, size)}});
+  }
+  case SF_TYPE_ANNO:
+  {
+    check_exit(list->size == 3, "type-anno requires exactly two arguments");
+    const node_t *value = compile_node(c, list->cells[1], false);
+    const value_type_t type = parse_type(list->cells[2]);
+    // proven annotations cost nothing, the others are checked where the value enters typed code
+    if (type == TYPE_ANY || value->type == type)
+      return value;
+    return node_alloc(arena, (node_t){.kind = N_CHECK, .type = type, .check = {.value = value}});
+  }
+  case SF_WORD:
+  {
+    check_exit(list->size == 2, "word requires exactly one argument");
+    // the form is a value that may be bound by def, so it outlives the scratch arena of a top-level form
+    const form_t *word_form = def_env_word_form(c->denv, get_word(list->cells[1]));
+    return node_alloc(arena, (node_t){.kind = N_FORM, .form = word_form});
+  }
+  case SF_LETFN:
+  case SF_FUNC:
+  {
+    exitWithError("not implemented");
+  }
+  case SF_DEF:
+  case SF_DEFN:
+  case SF_DEFEXPR:
+  case SF_DEFMACRO:
+  case SF_LOAD:
+  case SF_TYPE:
+  case SF_IMPORT:
+  case SF_EXPORT:
+    exitWithError("unexpected top special form in exp");
+  default:
+    printf("unknown special form: %s\n", name->chars);
+    exitWithError("unknown special form");
+  }
+  exit(1);
+}
+
+const node_t *compile_exp(def_env_t *denv, arena_t *arena, const form_t *form, int *frame_size)
+{
+  compiler_t c = {.arena = arena, .denv = denv};
+  const node_t *node = compile_node(&c, form, false);
+  compiler_free(&c);
+  *frame_size = c.frame_size;
+  return node;
+}
+
+// a parameter is a word or [type-anno word type]
+static const word_t *param_word(const form_t *form, value_type_t *type)
+{
+  *type = TYPE_ANY;
+  if (form->type == T_WORD)
+    return form->word;
+  const form_list_t *anno = form->list;
+  const word_t *head = anno->size == 3 ? try_get_word(anno->cells[0]) : nullptr;
+  check_exit(head && strcmp(head->chars, "type-anno") == 0, "parameter must be a word or a type-anno");
+  *type = parse_type(anno->cells[2]);
+  return get_word(anno->cells[1]);
+}
+
+// whether evaluating node may read the local in slot, a value that is never read cannot escape
+static bool reads_slot(const node_t *node, int slot)
+{
+  switch (node->kind)
+  {
+  case N_I32:
+  case N_F64:
+  case N_FORM:
+  case N_GLOBAL:
+  case N_DEF:
+  case N_DEFN:
+    return false;
+  case N_LOCAL:
+    return node->slot == slot;
+  case N_INTRINSIC:
+  case N_INTRINSIC_UNCHECKED:
+    return reads_slot(node->intrinsic.a, slot) || reads_slot(node->intrinsic.b, slot);
+  case N_CHECK:
+    return reads_slot(node->check.value, slot);
+  case N_IF:
+    return reads_slot(node->if_.cond, slot) || reads_slot(node->if_.then, slot) || reads_slot(node->if_.otherwise, slot);
+  case N_DO:
+    for (size_t i = 0; i < node->seq.size; i++)
+    {
+      if (reads_slot(node->seq.exps[i], slot))
+        return true;
+    }
+    return false;
+  case N_LET:
+  case N_LOOP:
+    for (size_t i = 0; i < node->let.size; i++)
+    {
+      if (reads_slot(node->let.bindings[i].value, slot))
+        return true;
+    }
+    return reads_slot(node->let.body, slot);
+  case N_CONTINUE:
+    for (size_t i = 0; i < node->cont.size; i++)
+    {
+      if (reads_slot(node->cont.bindings[i].value, slot))
+        return true;
+    }
+    return false;
+  case N_SWITCH:
+    if (reads_slot(node->switch_.value, slot) || reads_slot(node->switch_.default_case, slot))
+      return true;
+    for (size_t i = 0; i < node->switch_.size; i++)
+    {
+      const switch_case_t *switch_case = &node->switch_.cases[i];
+      for (size_t j = 0; j < switch_case->size; j++)
+      {
+        if (reads_slot(switch_case->values[j], slot))
+          return true;
+      }
+      if (reads_slot(switch_case->body, slot))
+        return true;
+    }
+    return false;
+  case N_CALL:
+    for (size_t i = 0; i < node->call.size; i++)
+    {
+      if (reads_slot(node->call.args[i], slot))
+        return true;
+    }
+    return reads_slot(node->call.fn, slot);
+  }
+  return true;
+}
+
+static const node_t *compile_defn(def_env_t *denv, const form_list_t *list, bool is_macro)
+{
+  check_exit(list->size >= 3, "defn requires at least three arguments");
+  const word_t *fname = get_word(list->cells[1]);
+  const form_list_t *paramForms = get_list(list->cells[2]);
+  bool has_rest = false;
+  int arity = paramForms->size;
+  const word_t *dots = paramForms->size > 1 ? try_get_word(paramForms->cells[paramForms->size - 2]) : nullptr;
+  if (dots && strncmp(dots->chars, "..", 2) == 0)
+  {
+    arity = paramForms->size - 2;
+    has_rest = true;
+  }
+  const int slot = def_env_slot(denv, fname);
+  // the function outlives the top-level form, so its body goes in an arena of its own that is
+  // freed when the function is collected
+  arena_t arena = {.allocator = denv->allocator};
+  compiler_t c = {.arena = &arena, .denv = denv};
+  // annotated parameters are checked once on entry, the body can rely on their types
+  const node_t **exps = arena_alloc(c.arena, sizeof(node_t *) * (arity + 1));
+  size_t num_checks = 0;
+  for (int i = 0; i < arity; i++)
+  {
+    value_type_t type;
+    const word_t *param = param_word(paramForms->cells[i], &type);
+    const int param_slot = scope_push(&c, param, type);
+    if (type == TYPE_ANY)
+      continue;
+    const node_t *local = node_alloc(c.arena, (node_t){.kind = N_LOCAL, .slot = param_slot});
+    exps[num_checks++] = node_alloc(c.arena, (node_t){.kind = N_CHECK, .type = type, .check = {.value = local}});
+  }
+  const int rest_slot = has_rest ? scope_push(&c, get_word(paramForms->cells[paramForms->size - 1]), TYPE_ANY) : -1;
+  const node_t *body = compile_seq(&c, list, 3, false);
+  if (num_checks > 0)
+  {
+    exps[num_checks] = body;
+    body = node_alloc(c.arena, (node_t){.kind = N_DO, .type = body->type, .seq = {.size = num_checks + 1, .exps = exps}});
+  }
+  compiler_free(&c);
+  return node_alloc(&denv->scratch, (node_t){
+                                        .kind = N_DEFN,
+                                        .defn = {
+                                            .name = fname,
+                                            .slot = slot,
+                                            .arity = arity,
+                                            .has_rest = has_rest,
+                                            // unused values are dropped from sequences, so this also holds when the list is only discarded
+                                            .rest_unread = has_rest && !reads_slot(body, rest_slot),
+                                            .frame_size = c.frame_size,
+                                            .body = body,
+                                            .is_macro = is_macro,
+                                            .arena = arena}});
+}
+
+const node_t *compile_top(def_env_t *denv, const form_t *form, int *frame_size)
+{
+  arena_reset(&denv->scratch);
+  *frame_size = 0;
+  // a macro call at top level may expand to a definition
+  for (int macro = top_macro_slot(denv, form); macro >= 0; macro = top_macro_slot(denv, form))
+    form = run_macro(denv, form, macro);
+  if (form->type == T_LIST && form->list->size > 0)
+  {
+    const form_list_t *list = form->list;
+    const word_t *name = try_get_word(list->cells[0]);
+    const struct special_form *spec = name ? try_get_wuns_special_form(name->chars, name->size) : nullptr;
+    if (spec != nullptr)
+    {
+      switch (spec->type)
+      {
+      case SF_DEF:
+      {
+        check_exit(list->size == 3, "def requires exactly two arguments");
+        const word_t *var = get_word(list->cells[1]);
+        const node_t *value = compile_exp(denv, &denv->scratch, list->cells[2], frame_size);
+        return node_alloc(&denv->scratch, (node_t){.kind = N_DEF, .def = {.name = var, .slot = def_env_slot(denv, var), .value = value}});
+      }
+      case SF_DEFN:
+        return compile_defn(denv, list, false);
+      case SF_DEFMACRO:
+        return compile_defn(denv, list, true);
+      case SF_DEFEXPR:
+      case SF_LOAD:
+      case SF_TYPE:
+      case SF_IMPORT:
+      case SF_EXPORT:
+        exitWithError("not implemented");
+      default:
+        break;
+      }
+    }
+  }
+  return compile_exp(denv, &denv->scratch, form, frame_size);
+}
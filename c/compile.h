@@ -0,0 +1,223 @@
+#pragma once
+
+#include "interpreter2.h"
+
+typedef enum
+{
+  INTRINSIC_I32_ADD,
+  INTRINSIC_I32_SUB,
+  INTRINSIC_I32_MUL,
+  INTRINSIC_I32_DIV_S,
+  INTRINSIC_I32_REM_S,
+
+  INTRINSIC_I32_EQ,
+  INTRINSIC_I32_NE,
+  INTRINSIC_I32_LT_S,
+  INTRINSIC_I32_GT_S,
+  INTRINSIC_I32_LE_S,
+  INTRINSIC_I32_GE_S,
+
+  INTRINSIC_I32_AND,
+  INTRINSIC_I32_OR,
+  INTRINSIC_I32_XOR,
+  INTRINSIC_I32_SHL,
+  INTRINSIC_I32_SHR_S,
+  INTRINSIC_I32_SHR_U,
+
+  INTRINSIC_F64_ADD,
+  INTRINSIC_F64_SUB,
+  INTRINSIC_F64_MUL,
+  INTRINSIC_F64_DIV,
+
+  INTRINSIC_F64_EQ,
+  INTRINSIC_F64_NE,
+  INTRINSIC_F64_LT,
+  INTRINSIC_F64_GT,
+  INTRINSIC_F64_LE,
+  INTRINSIC_F64_GE
+} intrinsic_type_t;
+
+typedef enum
+{
+  // i32 x i32 -> i32
+  INTRINSIC_KIND_I32,
+  // f64 x f64 -> f64
+  INTRINSIC_KIND_F64_ARITH,
+  // f64 x f64 -> i32
+  INTRINSIC_KIND_F64_CMP,
+} intrinsic_kind_t;
+
+intrinsic_kind_t intrinsic_kind(intrinsic_type_t t);
+int32_t eval_i32_bin_intrinsic(intrinsic_type_t t, int32_t a, int32_t b);
+double eval_f64_bin_arith_intrinsic(intrinsic_type_t t, double a, double b);
+bool eval_f64_bin_cmp_intrinsic(intrinsic_type_t t, double a, double b);
+
+// what the compiler has proven about the value of a node, from literals, intrinsics and
+// type-anno forms, values of unknown type are checked where they are used
+typedef enum
+{
+  TYPE_ANY,
+  TYPE_I32,
+  TYPE_F64,
+} value_type_t;
+
+static inline rtval_tag value_type_tag(value_type_t type)
+{
+  return type == TYPE_I32 ? rtval_i32 : rtval_f64;
+}
+
+// forms compiled once, with special forms, literals, intrinsics and variables resolved
+typedef enum
+{
+  N_I32,
+  N_F64,
+  // a form value, from a word form or the arguments of a macro call
+  N_FORM,
+  // a slot in the frame of the enclosing function or top-level form
+  N_LOCAL,
+  // a slot in the definition environment
+  N_GLOBAL,
+  N_INTRINSIC,
+  // an intrinsic whose operands are proven to have its argument type, so they are not checked
+  N_INTRINSIC_UNCHECKED,
+  // a type-anno the compiler could not prove, checks the value has the node's type
+  N_CHECK,
+  N_IF,
+  N_DO,
+  N_LET,
+  N_LOOP,
+  N_CONTINUE,
+  N_SWITCH,
+  N_CALL,
+  // only at top level
+  N_DEF,
+  N_DEFN,
+} node_kind_t;
+
+typedef struct node node_t;
+
+typedef struct
+{
+  int slot;
+  const node_t *value;
+} node_binding_t;
+
+typedef struct
+{
+  size_t size;
+  const node_t **values;
+  const node_t *body;
+} switch_case_t;
+
+// maps the values of a switch whose case values are all i32 literals to case indices
+typedef struct
+{
+  // dense tables are indexed by value - min, sparse ones hold sorted keys
+  bool dense;
+  int32_t min;
+  size_t size;
+  const int32_t *keys;
+  // case index, -1 for the default case
+  const int32_t *cases;
+} switch_table_t;
+
+// the case index for value, or -1 for the default case
+int switch_table_lookup(const switch_table_t *table, int32_t value);
+
+struct node
+{
+  node_kind_t kind;
+  value_type_t type;
+  union
+  {
+    int32_t i32;
+    double f64;
+    const form_t *form;
+    int slot;
+    struct
+    {
+      intrinsic_type_t op;
+      const node_t *a;
+      const node_t *b;
+    } intrinsic;
+    struct
+    {
+      const node_t *value;
+    } check;
+    struct
+    {
+      const node_t *cond;
+      const node_t *then;
+      const node_t *otherwise;
+    } if_;
+    // do and the bodies of let, loop and defn
+    struct
+    {
+      size_t size;
+      const node_t **exps;
+    } seq;
+    // let and loop
+    struct
+    {
+      size_t size;
+      const node_binding_t *bindings;
+      const node_t *body;
+      // loop only, every continue in the body is in tail position
+      bool jump_continues;
+    } let;
+    // the slots are those of the innermost loop
+    struct
+    {
+      size_t size;
+      const node_binding_t *bindings;
+      // the loop if the continue is in tail position of its body, otherwise it evaluates to a continue
+      const node_t *loop;
+    } cont;
+    struct
+    {
+      const node_t *value;
+      size_t size;
+      const switch_case_t *cases;
+      const node_t *default_case;
+      // nullptr unless all case values are i32 literals
+      const switch_table_t *table;
+    } switch_;
+    struct
+    {
+      // an N_LOCAL or N_GLOBAL node
+      const node_t *fn;
+      size_t size;
+      const node_t **args;
+    } call;
+    struct
+    {
+      const word_t *name;
+      int slot;
+      const node_t *value;
+    } def;
+    struct
+    {
+      const word_t *name;
+      int slot;
+      int arity;
+      bool has_rest;
+      // the body never reads the rest list, so calls need not make it
+      bool rest_unread;
+      // parameters take the first slots, then the rest list if any
+      int frame_size;
+      const node_t *body;
+      // from a defmacro
+      bool is_macro;
+      // holds the body, the function made from the node takes it over
+      arena_t arena;
+    } defn;
+  };
+};
+
+// compile a top-level form, function bodies are allocated in the environment's arena
+// and everything else in its scratch arena, which is reset first
+// *frame_size is set to the number of local slots needed to evaluate the node
+// calls of macros defined so far are replaced by their expansion, running the macro once per call
+const node_t *compile_top(def_env_t *denv, const form_t *form, int *frame_size);
+// compile an expression, all nodes are allocated in arena
+const node_t *compile_exp(def_env_t *denv, arena_t *arena, const form_t *form, int *frame_size);
@@ -0,0 +1,236 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytecode.h"
+#include "jit.h"
+
+// the first collection waits for this many bytes, later ones for as many as survived the last
+#define GC_MIN_THRESHOLD (1024 * 1024)
+#define INIT_MARK_CAPACITY 64
+#define INIT_PIN_CAPACITY 16
+
+typedef enum
+{
+  GC_LIST,
+  GC_FUNC,
+} gc_kind_t;
+
+// the header before every object
+struct gc_object
+{
+  gc_object_t *next;
+  size_t size;
+  gc_kind_t kind;
+  bool marked;
+  max_align_t data[];
+};
+
+static gc_object_t *object_of(const void *data)
+{
+  return (gc_object_t *)((char *)data - offsetof(gc_object_t, data));
+}
+
+static void *gc_alloc(def_env_t *denv, gc_kind_t kind, size_t size)
+{
+  gc_heap_t *heap = &denv->heap;
+  if (heap->threshold == 0)
+    heap->threshold = GC_MIN_THRESHOLD;
+  if (heap->allocated >= heap->threshold)
+    gc_collect(denv);
+  gc_object_t *object = allocator_alloc(denv->allocator, sizeof(gc_object_t) + size);
+  *object = (gc_object_t){.next = heap->objects, .size = size, .kind = kind};
+  heap->objects = object;
+  heap->allocated += size;
+  return object->data;
+}
+
+rtval_list_t *gc_alloc_list(def_env_t *denv, size_t size)
+{
+  rtval_list_t *list = gc_alloc(denv, GC_LIST, sizeof(rtval_list_t) + sizeof(rtval_t) * size);
+  list->size = size;
+  for (size_t i = 0; i < size; i++)
+    list->values[i] = rtval_make_undefined();
+  return list;
+}
+
+rtfunc_t *gc_alloc_func(def_env_t *denv)
+{
+  return gc_alloc(denv, GC_FUNC, sizeof(rtfunc_t));
+}
+
+// the list or function of value, nullptr for values that are not collected
+static const void *object_data(rtval_t value)
+{
+  switch (rtval_get_tag(value))
+  {
+  case rtval_list:
+    return rtval_get_list(value);
+  case rtval_func:
+    return rtval_get_func(value);
+  default:
+    return nullptr;
+  }
+}
+
+// mark the object of value, lists are pushed to have their values marked
+static void mark_value(const allocator_t *allocator, gc_heap_t *heap, rtval_t value)
+{
+  const void *data = object_data(value);
+  if (data == nullptr)
+    return;
+  gc_object_t *object = object_of(data);
+  if (object->marked)
+    return;
+  object->marked = true;
+  if (object->kind != GC_LIST)
+    return;
+  if (heap->mark_size == heap->mark_capacity)
+  {
+    const size_t old_capacity = heap->mark_capacity;
+    heap->mark_capacity = old_capacity ? old_capacity * 2 : INIT_MARK_CAPACITY;
+    heap->marks = allocator_realloc(allocator, heap->marks, sizeof(rtval_list_t *) * old_capacity,
+                                    sizeof(rtval_list_t *) * heap->mark_capacity);
+  }
+  heap->marks[heap->mark_size++] = data;
+}
+
+// mark from value without recursing, so deeply nested lists do not overflow the C stack
+static void mark(def_env_t *denv, rtval_t value)
+{
+  gc_heap_t *heap = &denv->heap;
+  mark_value(denv->allocator, heap, value);
+  while (heap->mark_size > 0)
+  {
+    const rtval_list_t *list = heap->marks[--heap->mark_size];
+    for (size_t i = 0; i < list->size; i++)
+      mark_value(denv->allocator, heap, list->values[i]);
+  }
+}
+
+static void mark_range(def_env_t *denv, const rtval_t *start, const rtval_t *end)
+{
+  for (const rtval_t *value = start; value < end; value++)
+    mark(denv, *value);
+}
+
+static void free_object(const allocator_t *allocator, gc_object_t *object)
+{
+  if (object->kind == GC_FUNC)
+  {
+    rtfunc_t *func = (void *)object->data;
+    jit_free(allocator, func->jit);
+    arena_free(&func->arena);
+  }
+  allocator_free(allocator, object, sizeof(gc_object_t) + object->size);
+}
+
+// free the unmarked objects and clear the marks, returns the bytes kept
+static size_t sweep(def_env_t *denv)
+{
+  gc_heap_t *heap = &denv->heap;
+  size_t kept = 0;
+  gc_object_t **link = &heap->objects;
+  while (*link != nullptr)
+  {
+    gc_object_t *object = *link;
+    if (object->marked)
+    {
+      object->marked = false;
+      kept += object->size;
+      link = &object->next;
+    }
+    else
+    {
+      *link = object->next;
+      free_object(denv->allocator, object);
+    }
+  }
+  return kept;
+}
+
+void gc_collect(def_env_t *denv)
+{
+  gc_heap_t *heap = &denv->heap;
+  for (int i = 0; i < denv->size; i++)
+    mark(denv, denv->bindings[i].value);
+  mark_range(denv, denv->stack.values, denv->stack.top);
+  mark_range(denv, heap->pins, heap->pins + heap->pin_size);
+  if (denv->vm != nullptr)
+  {
+    const rtval_t *start;
+    const rtval_t *end;
+    vm_live_values(denv->vm, &start, &end);
+    mark_range(denv, start, end);
+  }
+  const size_t kept = sweep(denv);
+  heap->allocated = 0;
+  heap->threshold = kept > GC_MIN_THRESHOLD ? kept : GC_MIN_THRESHOLD;
+}
+
+void gc_release(def_env_t *denv, rtval_t value)
+{
+  gc_heap_t *heap = &denv->heap;
+  mark(denv, value);
+  gc_object_t **link = &heap->objects;
+  while (*link != nullptr)
+  {
+    gc_object_t *object = *link;
+    if (object->marked)
+    {
+      object->marked = false;
+      *link = object->next;
+    }
+    else
+    {
+      link = &object->next;
+    }
+  }
+}
+
+void gc_pin(def_env_t *denv, rtval_t value)
+{
+  gc_heap_t *heap = &denv->heap;
+  if (object_data(value) == nullptr)
+    return;
+  if (heap->pin_size == heap->pin_capacity)
+  {
+    const size_t old_capacity = heap->pin_capacity;
+    heap->pin_capacity = old_capacity ? old_capacity * 2 : INIT_PIN_CAPACITY;
+    heap->pins = allocator_realloc(denv->allocator, heap->pins, sizeof(rtval_t) * old_capacity,
+                                   sizeof(rtval_t) * heap->pin_capacity);
+  }
+  heap->pins[heap->pin_size++] = value;
+}
+
+void gc_unpin(def_env_t *denv, rtval_t value)
+{
+  gc_heap_t *heap = &denv->heap;
+  const void *data = object_data(value);
+  if (data == nullptr)
+    return;
+  for (size_t i = heap->pin_size; i-- > 0;)
+  {
+    if (object_data(heap->pins[i]) == data)
+    {
+      heap->pins[i] = heap->pins[--heap->pin_size];
+      return;
+    }
+  }
+  exitWithError("unpinning a value that is not pinned");
+}
+
+void gc_free(def_env_t *denv)
+{
+  gc_heap_t *heap = &denv->heap;
+  gc_object_t *object = heap->objects;
+  while (object != nullptr)
+  {
+    gc_object_t *next = object->next;
+    free_object(denv->allocator, object);
+    object = next;
+  }
+  allocator_free(denv->allocator, heap->marks, sizeof(rtval_list_t *) * heap->mark_capacity);
+  allocator_free(denv->allocator, heap->pins, sizeof(rtval_t) * heap->pin_capacity);
+  *heap = (gc_heap_t){0};
+}
@@ -3,88 +3,178 @@
 #include <stdio.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <string.h>
 
 #include "interpreter2.h"
+#include "compile.h"
+#include "bytecode.h"
+#include "scan.h"
 
-bool is_whitespace(char c)
+// chunks double from the first size up to the usual one, so small arenas like a function's stay small
+#define ARENA_FIRST_CHUNK_SIZE 256
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+static size_t align_up(size_t size)
 {
-  return c == ' ' || c == '\n';
+  const size_t align = _Alignof(max_align_t);
+  return (size + align - 1) & ~(align - 1);
 }
 
-bool is_word_char(char c)
+void *arena_alloc(arena_t *arena, size_t size)
 {
-  switch (c)
+  size = align_up(size);
+  arena_chunk_t *chunk = arena->head;
+  if (chunk == nullptr || chunk->capacity - chunk->used < size)
   {
-  case '-':
-  case '.':
-  case '/':
-  case '0' ... '9':
-  case 'a' ... 'z':
-    return true;
-  default:
-    return false;
+    size_t capacity = chunk == nullptr ? ARENA_FIRST_CHUNK_SIZE : chunk->capacity * 2;
+    if (capacity > ARENA_CHUNK_SIZE)
+      capacity = ARENA_CHUNK_SIZE;
+    if (capacity < size)
+      capacity = size;
+    chunk = allocator_alloc(arena->allocator, sizeof(arena_chunk_t) + capacity);
+    chunk->next = arena->head;
+    chunk->capacity = capacity;
+    chunk->used = 0;
+    arena->head = chunk;
+  }
+  void *p = (char *)chunk->data + chunk->used;
+  chunk->used += size;
+  return p;
+}
+
+// release everything but keep the newest chunk around for reuse
+void arena_reset(arena_t *arena)
+{
+  arena_chunk_t *chunk = arena->head;
+  if (chunk == nullptr)
+    return;
+  arena_chunk_t *rest = chunk->next;
+  while (rest != nullptr)
+  {
+    arena_chunk_t *next = rest->next;
+    allocator_free(arena->allocator, rest, sizeof(arena_chunk_t) + rest->capacity);
+    rest = next;
   }
+  chunk->next = nullptr;
+  chunk->used = 0;
+}
+
+void arena_free(arena_t *arena)
+{
+  arena_chunk_t *chunk = arena->head;
+  while (chunk != nullptr)
+  {
+    arena_chunk_t *next = chunk->next;
+    allocator_free(arena->allocator, chunk, sizeof(arena_chunk_t) + chunk->capacity);
+    chunk = next;
+  }
+  arena->head = nullptr;
 }
 
 #define MAX_WORD_SIZE 127
+#define INIT_INTERN_CAPACITY 1024
 
-const word_t *word_make(const char *start, const size_t size)
+// every distinct word is stored once, so words can be compared by id
+typedef struct
+{
+  uint32_t capacity;
+  uint32_t count;
+  const word_t **slots;
+  arena_t arena;
+} intern_table_t;
+
+static intern_table_t intern_table = {0};
+
+static uint32_t word_hash(const char *start, size_t size)
+{
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; i++)
+  {
+    hash ^= (uint8_t)start[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void intern_table_grow(intern_table_t *table)
+{
+  const uint32_t old_capacity = table->capacity;
+  const word_t **old_slots = table->slots;
+  table->capacity = old_capacity ? old_capacity * 2 : INIT_INTERN_CAPACITY;
+  table->slots = calloc(table->capacity, sizeof(word_t *));
+  const uint32_t mask = table->capacity - 1;
+  for (uint32_t i = 0; i < old_capacity; i++)
+  {
+    const word_t *word = old_slots[i];
+    if (word == nullptr)
+      continue;
+    uint32_t j = word_hash(word->chars, word->size) & mask;
+    while (table->slots[j] != nullptr)
+      j = (j + 1) & mask;
+    table->slots[j] = word;
+  }
+  free(old_slots);
+}
+
+// the table is shared by all threads, parsers keep a private cache in front of it
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const word_t *word_intern_hashed(uint32_t hash, const char *start, const size_t size)
 {
   assert(size <= MAX_WORD_SIZE && "word size exceeded");
-  word_t *word = malloc(sizeof(word_t) + size + 1);
+  pthread_mutex_lock(&intern_lock);
+  intern_table_t *table = &intern_table;
+  if (table->count * 2 >= table->capacity)
+    intern_table_grow(table);
+  const uint32_t mask = table->capacity - 1;
+  uint32_t i = hash & mask;
+  const word_t *existing;
+  while ((existing = table->slots[i]) != nullptr)
+  {
+    if (existing->size == size && memcmp(existing->chars, start, size) == 0)
+    {
+      pthread_mutex_unlock(&intern_lock);
+      return existing;
+    }
+    i = (i + 1) & mask;
+  }
+  word_t *word = arena_alloc(&table->arena, sizeof(word_t) + size + 1);
+  word->id = table->count++;
   word->size = size;
   memcpy(word->chars, start, size);
   word->chars[size] = '\0';
+  table->slots[i] = word;
+  pthread_mutex_unlock(&intern_lock);
   return (const word_t *)word;
 }
 
-const word_t *word_copy(const word_t *word)
+const word_t *word_intern(const char *start, const size_t size)
 {
-  return word_make(word->chars, word->size);
+  return word_intern_hashed(word_hash(start, size), start, size);
 }
 
 bool word_eq(const word_t *a, const word_t *b)
 {
-  if (a->size != b->size)
-    return false;
-  return memcmp(a->chars, b->chars, a->size) == 0;
+  return a->id == b->id;
 }
 
-const form_t *form_alloc(form_t f)
+const form_t *form_alloc(arena_t *arena, form_t f)
 {
-  form_t *form = malloc(sizeof(form_t));
+  form_t *form = arena_alloc(arena, sizeof(form_t));
   *form = f;
   return form;
 }
 
-const form_t *form_word_alloc(const word_t *word)
+const form_t *form_word_alloc(arena_t *arena, const word_t *word)
 {
-  return form_alloc((form_t){T_WORD, .word = word});
+  return form_alloc(arena, (form_t){T_WORD, .word = word});
 }
 
-const form_t *form_list_alloc(const form_list_t *list)
+const form_t *form_list_alloc(arena_t *arena, const form_list_t *list)
 {
-  return form_alloc((form_t){T_LIST, .list = list});
-}
-
-void form_free(const form_t *form)
-{
-  switch (form->type)
-  {
-  case T_WORD:
-    free((void *)form->word);
-    break;
-  case T_LIST:
-  {
-    const form_list_t *list = form->list;
-    for (size_t i = 0; i < list->size; i++)
-      form_free((form_t *)list->cells[i]);
-    free((void *)list);
-    break;
-  }
-  }
-  free((void *)form);
+  return form_alloc(arena, (form_t){T_LIST, .list = list});
 }
 
 typedef struct
@@ -94,900 +184,667 @@ typedef struct
   const form_t **elements;
 } form_list_buffer_t;
 
-void append_form(form_list_buffer_t *buffer, const form_t *form)
+void append_form(const allocator_t *allocator, form_list_buffer_t *buffer, const form_t *form)
 {
   if (buffer->size == buffer->capacity)
   {
+    const size_t old_capacity = buffer->capacity;
     buffer->capacity *= 2;
-    buffer->elements = realloc(buffer->elements, sizeof(form_t *) * buffer->capacity);
+    buffer->elements = allocator_realloc(allocator, buffer->elements, sizeof(form_t *) * old_capacity,
+                                         sizeof(form_t *) * buffer->capacity);
   }
   buffer->elements[buffer->size++] = form;
 }
 
-const form_list_t *make_form_list_from_buffer(form_list_buffer_t *buffer)
+const form_list_t *make_form_list_from_buffer(arena_t *arena, form_list_buffer_t *buffer)
 {
   size_t size = buffer->size;
   size_t byte_size = sizeof(form_t *) * size;
-  form_list_t *list = malloc(sizeof(form_list_t) + byte_size);
+  form_list_t *list = arena_alloc(arena, sizeof(form_list_t) + byte_size);
   list->size = size;
   memcpy(list->cells, buffer->elements, byte_size);
   return list;
 }
 
-#define MAX_FORM_DEPTH 16
 #define INIT_BUFFER_SIZE 8
+#define INIT_STACK_CAPACITY 16
+#define WORD_CACHE_SIZE 1024
+#define INIT_WORD_SLOTS_CAPACITY 256
+#define VALUE_STACK_SIZE (1024 * 1024)
+#define INIT_BINDINGS_CAPACITY 128
 
-void exitWithError(const char *message)
+struct parser
 {
-  if (message != NULL)
-  {
-    fprintf(stderr, "Error: %s\n", message);
-  }
-  exit(1);
-}
-
-#define check_exit(cond, message) \
-  if (!(cond))                    \
-  exitWithError(message)
+  arena_t *arena;
+  form_callback_t on_form;
+  void *ctx;
+  // one buffer per nesting level, kept across forms so their elements can be reused
+  form_list_buffer_t *stack;
+  int stack_capacity;
+  int depth;
+  // a word cut off at the end of a chunk
+  size_t word_len;
+  char word[MAX_WORD_SIZE];
+  // direct mapped, saves taking the intern lock for words seen recently
+  const word_t *word_cache[WORD_CACHE_SIZE];
+};
 
-const form_t *parse_one(const char **start, const char *end)
+static void parser_init(parser_t *parser, arena_t *arena, form_callback_t on_form, void *ctx)
 {
-  char *cur = (char *)*start;
-  assert(cur != nullptr && "expected non-null start");
-  form_list_buffer_t stack[MAX_FORM_DEPTH] = {0};
-  int depth = -1;
-  const form_t *cur_form = nullptr;
-  while (cur < end)
-  {
-    const char c = *cur;
-    if (is_word_char(c))
-    {
-      const char *word_start = cur;
-      cur++;
-      size_t word_len = 1;
-      while (is_word_char(*cur))
-      {
-        cur++;
-        word_len++;
-        check_exit(word_len < MAX_WORD_SIZE, "word size exceeded");
-      }
-      cur_form = form_word_alloc(word_make(word_start, word_len));
-      if (depth == -1)
-        break;
-      append_form(&stack[depth], cur_form);
-    }
-    else if (is_whitespace(c))
-    {
-      cur++;
-    }
-    else if (c == '[')
-    {
-      cur++;
-      depth++;
-      check_exit(depth < MAX_FORM_DEPTH, "form depth exceeded");
-      assert(stack[depth].size == 0 && "unexpected non-empty stack");
-      if (stack[depth].elements == nullptr)
-      {
-        stack[depth].capacity = INIT_BUFFER_SIZE;
-        stack[depth].elements = malloc(sizeof(form_t *) * INIT_BUFFER_SIZE);
-      }
-    }
-    else if (c == ']')
-    {
-      cur++;
-      if (depth == -1)
-        break;
-      cur_form = form_list_alloc(make_form_list_from_buffer(&stack[depth]));
-      stack[depth].size = 0;
-      depth--;
-      if (depth == -1)
-        break;
-      append_form(&stack[depth], cur_form);
-    }
-    else
-    {
-      exitWithError("unknown character");
-    }
-  }
-  *start = cur;
-  while (depth > -1)
-  {
-    // close open lists
-    cur_form = form_list_alloc(make_form_list_from_buffer(&stack[depth]));
-    stack[depth].size = 0;
-    depth--;
-    if (depth == -1)
-      break;
-    append_form(&stack[depth], cur_form);
-  }
-  for (int i = 0; i < MAX_FORM_DEPTH; i++)
-  {
-    const form_t **elems = stack[i].elements;
-    if (elems == nullptr)
-      break;
-    free(elems);
-  }
-  return cur_form;
+  *parser = (parser_t){.arena = arena, .on_form = on_form, .ctx = ctx, .depth = -1};
 }
 
-void print_form(const form_t *form)
+static void parser_destroy(parser_t *parser)
 {
-  switch (form->type)
+  const allocator_t *allocator = parser->arena->allocator;
+  for (int i = 0; i < parser->stack_capacity; i++)
   {
-  case T_WORD:
-    printf("%s", form->word->chars);
-    break;
-  case T_LIST:
-    if (form->list->size == 0)
-    {
-      printf("[]");
-      return;
-    }
-    printf("[");
-    print_form(form->list->cells[0]);
-    for (size_t i = 1; i < form->list->size; i++)
-    {
-      printf(" ");
-      print_form(form->list->cells[i]);
-    }
-    printf("]");
-    break;
+    const form_list_buffer_t *buffer = &parser->stack[i];
+    if (buffer->elements == nullptr)
+      break;
+    allocator_free(allocator, buffer->elements, sizeof(form_t *) * buffer->capacity);
   }
+  allocator_free(allocator, parser->stack, sizeof(form_list_buffer_t) * parser->stack_capacity);
 }
 
-void print_rtval(const rtval_t *val)
+static form_list_buffer_t *parser_push_list(parser_t *parser)
 {
-  switch (val->tag)
-  {
-  case rtval_i32:
-    printf("%i", val->i32);
-    break;
-  case rtval_f64:
-    printf("%f", val->f64);
-    break;
-  case rtval_list:
+  parser->depth++;
+  if (parser->depth == parser->stack_capacity)
   {
-    rtval_list_t *list = val->list;
-    if (list->size == 0)
-    {
-      printf("[]");
-      return;
-    }
-    printf("[");
-    print_rtval(&list->values[0]);
-    for (size_t i = 1; i < list->size; i++)
-    {
-      printf(" ");
-      print_rtval(&list->values[i]);
-    }
-    printf("]");
-    break;
+    const int old_capacity = parser->stack_capacity;
+    parser->stack_capacity = old_capacity ? old_capacity * 2 : INIT_STACK_CAPACITY;
+    parser->stack = allocator_realloc(parser->arena->allocator, parser->stack, sizeof(form_list_buffer_t) * old_capacity,
+                                      sizeof(form_list_buffer_t) * parser->stack_capacity);
+    memset(parser->stack + old_capacity, 0, sizeof(form_list_buffer_t) * (parser->stack_capacity - old_capacity));
   }
-  case rtval_undefined:
-    printf("*undefined*");
-    break;
-  case rtval_continue:
-    printf("*continue*");
-    break;
-  case rtval_func:
-    printf("[fn %s]", val->func->name->chars);
-    break;
+  form_list_buffer_t *buffer = &parser->stack[parser->depth];
+  assert(buffer->size == 0 && "unexpected non-empty stack");
+  if (buffer->elements == nullptr)
+  {
+    buffer->capacity = INIT_BUFFER_SIZE;
+    buffer->elements = allocator_alloc(parser->arena->allocator, sizeof(form_t *) * INIT_BUFFER_SIZE);
   }
+  return buffer;
 }
 
-const word_t *try_get_word(const form_t *form)
+parser_t *parser_create(arena_t *arena, form_callback_t on_form, void *ctx)
 {
-  if (form->type != T_WORD)
-    return nullptr;
-  return form->word;
+  parser_t *parser = allocator_alloc(arena->allocator, sizeof(parser_t));
+  parser_init(parser, arena, on_form, ctx);
+  return parser;
 }
 
-const word_t *get_word(const form_t *form)
+void parser_free(parser_t *parser)
 {
-  check_exit(form->type == T_WORD, "expected word");
-  return form->word;
+  const allocator_t *allocator = parser->arena->allocator;
+  parser_destroy(parser);
+  allocator_free(allocator, parser, sizeof(parser_t));
 }
 
-const form_list_t *get_list(const form_t *form)
+static const word_t *parser_intern(parser_t *parser, const char *start, size_t size)
 {
-  check_exit(form->type == T_LIST, "expected list");
-  return form->list;
+  const uint32_t hash = word_hash(start, size);
+  const word_t **slot = &parser->word_cache[hash & (WORD_CACHE_SIZE - 1)];
+  const word_t *word = *slot;
+  if (word != nullptr && word->size == size && memcmp(word->chars, start, size) == 0)
+    return word;
+  word = word_intern_hashed(hash, start, size);
+  *slot = word;
+  return word;
 }
 
-int32_t parse_i32(const char *word)
+// add a completed form to the innermost open list, or emit it if it is a top-level form
+static bool parser_add(parser_t *parser, const form_t *form)
 {
-  char *endptr;
-  errno = 0;
-  const long result = strtol(word, &endptr, 10);
-  if (errno != 0)
-  {
-    perror("strtol");
-    exitWithError("non-integer argument for 'i32'");
-  }
-  check_exit(*endptr == '\0', "non-integer argument for 'i32'");
-  check_exit(result >= INT32_MIN && result <= INT32_MAX, "integer out of range for 'i32'");
-  return (int32_t)result;
+  if (parser->depth == -1)
+    return parser->on_form(parser->ctx, form);
+  append_form(parser->arena->allocator, &parser->stack[parser->depth], form);
+  return true;
 }
 
-double parse_f64(const char *word)
+static bool parser_close_list(parser_t *parser)
 {
-  char *endptr;
-  errno = 0;
-  const double result = strtod(word, &endptr);
-  if (errno != 0)
-  {
-    perror("strtod");
-    exitWithError("non-float argument for 'f64'");
-  }
-  check_exit(*endptr == '\0', "non-float argument for 'f64'");
-  return result;
+  form_list_buffer_t *buffer = &parser->stack[parser->depth];
+  const form_t *form = form_list_alloc(parser->arena, make_form_list_from_buffer(parser->arena, buffer));
+  buffer->size = 0;
+  parser->depth--;
+  return parser_add(parser, form);
 }
 
-typedef enum
-{
-  SF_I32,
-  SF_F64,
-  SF_WORD,
-  SF_INTRINSIC,
-  SF_IF,
-  SF_DO,
-  SF_LET,
-  SF_LETFN,
-  SF_TYPE_ANNO,
-  SF_LOOP,
-  SF_CONTINUE,
-  SF_SWITCH,
-  SF_FUNC,
-  SF_DEF,
-  SF_DEFN,
-  SF_DEFEXPR,
-  SF_DEFMACRO,
-  SF_LOAD,
-  SF_TYPE,
-  SF_IMPORT,
-  SF_EXPORT
-} special_form_type_t;
-
-typedef struct special_form
-{
-  char *name;
-  special_form_type_t type;
-} special_form_t;
-
-typedef enum
-{
-  INTRINSIC_I32_ADD,
-  INTRINSIC_I32_SUB,
-  INTRINSIC_I32_MUL,
-  INTRINSIC_I32_DIV_S,
-  INTRINSIC_I32_REM_S,
-
-  INTRINSIC_I32_EQ,
-  INTRINSIC_I32_NE,
-  INTRINSIC_I32_LT_S,
-  INTRINSIC_I32_GT_S,
-  INTRINSIC_I32_LE_S,
-  INTRINSIC_I32_GE_S,
-
-  INTRINSIC_I32_AND,
-  INTRINSIC_I32_OR,
-  INTRINSIC_I32_XOR,
-  INTRINSIC_I32_SHL,
-  INTRINSIC_I32_SHR_S,
-  INTRINSIC_I32_SHR_U,
-
-  INTRINSIC_F64_ADD,
-  INTRINSIC_F64_SUB,
-  INTRINSIC_F64_MUL,
-  INTRINSIC_F64_DIV,
-
-  INTRINSIC_F64_EQ,
-  INTRINSIC_F64_NE,
-  INTRINSIC_F64_LT,
-  INTRINSIC_F64_GT,
-  INTRINSIC_F64_LE,
-  INTRINSIC_F64_GE
-} intrinsic_type_t;
-
-typedef struct intrinsic
+static bool parser_flush_word(parser_t *parser)
 {
-  char *name;
-  intrinsic_type_t type;
-} intrinsic_t;
-
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wmissing-field-initializers"
-#include "special_forms.h"
-
-#include "intrinsics.h"
-#pragma clang diagnostic pop
+  const word_t *word = parser_intern(parser, parser->word, parser->word_len);
+  parser->word_len = 0;
+  return parser_add(parser, form_word_alloc(parser->arena, word));
+}
 
-int32_t eval_i32_bin_intrinsic(intrinsic_type_t t, int32_t a, int32_t b)
+bool parser_feed(parser_t *parser, const char **start, const char *end)
 {
-  switch (t)
+  const char *cur = *start;
+  assert(cur != nullptr && "expected non-null start");
+  bool keep_going = true;
+  if (parser->word_len > 0)
   {
-  case INTRINSIC_I32_ADD:
-    return a + b;
-  case INTRINSIC_I32_SUB:
-    return a - b;
-  case INTRINSIC_I32_MUL:
-    return a * b;
-  case INTRINSIC_I32_DIV_S:
-    return a / b;
-  case INTRINSIC_I32_REM_S:
-    return a % b;
-
-  case INTRINSIC_I32_EQ:
-    return a == b;
-  case INTRINSIC_I32_NE:
-    return a != b;
-  case INTRINSIC_I32_LT_S:
-    return a < b;
-  case INTRINSIC_I32_GT_S:
-    return a > b;
-  case INTRINSIC_I32_LE_S:
-    return a <= b;
-  case INTRINSIC_I32_GE_S:
-    return a >= b;
-
-  case INTRINSIC_I32_AND:
-    return a & b;
-  case INTRINSIC_I32_OR:
-    return a | b;
-  case INTRINSIC_I32_XOR:
-    return a ^ b;
-  case INTRINSIC_I32_SHL:
-    return a << b;
-  case INTRINSIC_I32_SHR_S:
-    return a >> b;
-  case INTRINSIC_I32_SHR_U:
-    return (unsigned)a >> (unsigned)b;
-  default:
-    break;
+    const char *word_end = scan_word_end(cur, end);
+    const size_t word_len = parser->word_len + (word_end - cur);
+    check_exit(word_len < MAX_WORD_SIZE, "word size exceeded");
+    memcpy(parser->word + parser->word_len, cur, word_end - cur);
+    parser->word_len = word_len;
+    cur = word_end;
+    if (cur < end)
+      keep_going = parser_flush_word(parser);
   }
-  printf("Error: unknown intrinsic type\n");
-  exit(1);
-}
-
-double eval_f64_bin_arith_intrinsic(intrinsic_type_t t, double a, double b)
-{
-  switch (t)
+  while (keep_going && cur < end)
   {
-  case INTRINSIC_F64_ADD:
-    return a + b;
-  case INTRINSIC_F64_SUB:
-    return a - b;
-  case INTRINSIC_F64_MUL:
-    return a * b;
-  case INTRINSIC_F64_DIV:
-    return a / b;
-  default:
-    break;
+    const char c = *cur;
+    if (is_word_char(c))
+    {
+      const char *word_start = cur;
+      cur = scan_word_end(cur + 1, end);
+      const size_t word_len = cur - word_start;
+      check_exit(word_len < MAX_WORD_SIZE, "word size exceeded");
+      if (cur == end)
+      {
+        // the word may continue in the next chunk
+        memcpy(parser->word, word_start, word_len);
+        parser->word_len = word_len;
+        break;
+      }
+      keep_going = parser_add(parser, form_word_alloc(parser->arena, parser_intern(parser, word_start, word_len)));
+    }
+    else if (is_whitespace(c))
+    {
+      cur = scan_whitespace_end(cur + 1, end);
+    }
+    else if (c == '[')
+    {
+      cur++;
+      parser_push_list(parser);
+    }
+    else if (c == ']')
+    {
+      cur++;
+      if (parser->depth == -1)
+        keep_going = false;
+      else
+        keep_going = parser_close_list(parser);
+    }
+    else
+    {
+      exitWithError("unknown character");
+    }
   }
-  printf("Error: unknown intrinsic type\n");
-  exit(1);
+  *start = cur;
+  return keep_going;
 }
 
-bool eval_f64_bin_cmp_intrinsic(intrinsic_type_t t, double a, double b)
+void parser_finish(parser_t *parser)
 {
-  switch (t)
-  {
-  case INTRINSIC_F64_EQ:
-    return a == b;
-  case INTRINSIC_F64_NE:
-    return a != b;
-  case INTRINSIC_F64_LT:
-    return a < b;
-  case INTRINSIC_F64_GT:
-    return a > b;
-  case INTRINSIC_F64_LE:
-    return a <= b;
-  default:
-    break;
-  }
-  printf("Error: unknown intrinsic type\n");
-  exit(1);
+  if (parser->word_len > 0)
+    parser_flush_word(parser);
+  // close open lists
+  while (parser->depth > -1)
+    parser_close_list(parser);
 }
 
-typedef struct
+static bool store_form_and_stop(void *ctx, const form_t *form)
 {
-  int len;
-  binding_t *bindings;
-  const special_form_type_t special_form_type;
-} local_env_t;
+  *(const form_t **)ctx = form;
+  return false;
+}
 
-typedef enum env_type
+const form_t *parse_one(parser_t *parser, const char **start, const char *end)
 {
-  ENV_DEF,
-  ENV_LOCAL
-} env_type_t;
+  assert(parser->depth == -1 && parser->word_len == 0 && "parser is in the middle of a form");
+  const form_callback_t on_form = parser->on_form;
+  void *ctx = parser->ctx;
+  const form_t *form = nullptr;
+  parser->on_form = store_form_and_stop;
+  parser->ctx = &form;
+  if (parser_feed(parser, start, end))
+    parser_finish(parser);
+  parser->on_form = on_form;
+  parser->ctx = ctx;
+  return form;
+}
 
+// the locals of a function call or top-level form, addressed by the slots resolved when compiling
 typedef struct
 {
-  const struct local_stack *parent;
-  local_env_t *env;
-} local_stack_frame_t;
+  def_env_t *def_env;
+  rtval_t *slots;
+} frame_t;
 
-typedef struct local_stack
+// the stack of an environment is allocated on its first evaluation and never moved
+static void value_stack_init(def_env_t *denv)
 {
-  env_type_t type;
-  union
-  {
-    const def_env_t *def_env;
-    local_stack_frame_t *frame;
-  };
-} local_stack_t;
+  value_stack_t *stack = &denv->stack;
+  if (stack->values != nullptr)
+    return;
+  stack->values = allocator_alloc(denv->allocator, sizeof(rtval_t) * VALUE_STACK_SIZE);
+  stack->top = stack->values;
+  stack->end = stack->values + VALUE_STACK_SIZE;
+}
 
-const def_env_t *get_def_env(const local_stack_t *stackp)
+static rtval_t *value_stack_push(value_stack_t *stack, int size)
 {
-  const local_stack_t *stack = stackp;
-  while (stack->type == ENV_LOCAL)
-  {
-    stack = stack->frame->parent;
-  }
-  return stack->def_env;
+  check_exit(stack->end - stack->top >= size, "stack overflow");
+  rtval_t *slots = stack->top;
+  stack->top += size;
+  // the collector scans the whole stack, so slots not set yet must not hold stale values
+  for (int i = 0; i < size; i++)
+    slots[i] = rtval_make_undefined();
+  return slots;
 }
 
-local_env_t *get_outer_loop(const local_stack_t *stackp)
+// pop everything from slots up
+static void value_stack_pop(value_stack_t *stack, rtval_t *slots)
 {
-  local_stack_t *stack = (local_stack_t *)stackp;
-  while (stack->type == ENV_LOCAL)
-  {
-    if (stack->frame->env->special_form_type == SF_LOOP)
-      return stack->frame->env;
-    stack = (local_stack_t *)stack->frame->parent;
-  }
-  return nullptr;
+  stack->top = slots;
 }
 
-void def_env_set(def_env_t *denv, const word_t *word, rtval_t value)
+int def_env_slot(def_env_t *denv, const word_t *word)
 {
-  for (int i = 0; i < denv->size; i++)
+  if (word->id >= denv->word_slots_capacity)
   {
-    if (word_eq(denv->bindings[i].name, word))
-    {
-      // here we need to free the old value, we leak memory here
-      // but it could be referenced elsewhere
-      denv->bindings[i].value = value;
-      return;
-    }
+    const uint32_t old_capacity = denv->word_slots_capacity;
+    uint32_t capacity = old_capacity ? old_capacity : INIT_WORD_SLOTS_CAPACITY;
+    while (capacity <= word->id)
+      capacity *= 2;
+    denv->word_slots = allocator_realloc(denv->allocator, denv->word_slots, sizeof(int) * old_capacity, sizeof(int) * capacity);
+    memset(denv->word_slots + old_capacity, 0, sizeof(int) * (capacity - old_capacity));
+    denv->word_slots_capacity = capacity;
   }
+  const int slot = denv->word_slots[word->id];
+  if (slot != 0)
+    return slot - 1;
   if (denv->size == denv->capacity)
   {
+    const int old_capacity = denv->capacity;
     denv->capacity *= 2;
-    denv->bindings = realloc(denv->bindings, sizeof(binding_t) * denv->capacity);
+    denv->bindings = allocator_realloc(denv->allocator, denv->bindings, sizeof(binding_t) * old_capacity,
+                                       sizeof(binding_t) * denv->capacity);
   }
-  denv->bindings[denv->size++] = (binding_t){.name = (word_t *)word_copy(word), .value = value};
+  denv->bindings[denv->size] = (binding_t){.name = word, .value = rtval_make_undefined()};
+  denv->word_slots[word->id] = denv->size + 1;
+  return denv->size++;
 }
 
-rtval_t def_env_lookup(const def_env_t *denv, const word_t *word)
+const form_t *def_env_word_form(def_env_t *denv, const word_t *word)
 {
-  for (int i = 0; i < denv->size; i++)
+  if (word->id >= denv->word_forms_capacity)
   {
-    binding_t binding = denv->bindings[i];
-    if (word_eq(binding.name, word))
-      return binding.value;
+    const uint32_t old_capacity = denv->word_forms_capacity;
+    uint32_t capacity = old_capacity ? old_capacity : INIT_WORD_SLOTS_CAPACITY;
+    while (capacity <= word->id)
+      capacity *= 2;
+    denv->word_forms = allocator_realloc(denv->allocator, denv->word_forms, sizeof(form_t *) * old_capacity,
+                                         sizeof(form_t *) * capacity);
+    memset(denv->word_forms + old_capacity, 0, sizeof(form_t *) * (capacity - old_capacity));
+    denv->word_forms_capacity = capacity;
   }
-  exitWithError("word not found in env");
-  exit(1);
+  const form_t *form = denv->word_forms[word->id];
+  if (form == nullptr)
+  {
+    form_t *word_form = arena_alloc(&denv->arena, sizeof(form_t));
+    *word_form = (form_t){.type = T_WORD, .word = word};
+    denv->word_forms[word->id] = form = word_form;
+  }
+  return form;
 }
 
-rtval_t lookup(const local_stack_t *env, const word_t *word)
+rtval_t eval_node(const frame_t *frame, const node_t *node);
+
+static double eval_f64(const frame_t *frame, const node_t *node);
+
+// the value of a node the compiler proved to be an i32, typed subexpressions are not boxed
+static int32_t eval_i32(const frame_t *frame, const node_t *node)
 {
-  const local_stack_t *cur_stack = env;
-  while (cur_stack != nullptr)
+  switch (node->kind)
   {
-    if (cur_stack->type == ENV_DEF)
-      return def_env_lookup(cur_stack->def_env, word);
-    assert(cur_stack->type == ENV_LOCAL && "expected local env");
-    const local_env_t *cur_env = cur_stack->frame->env;
-    for (int i = cur_env->len; i-- > 0;)
-    {
-      if (word_eq(cur_env->bindings[i].name, word))
-        return cur_env->bindings[i].value;
-    }
-    cur_stack = cur_stack->frame->parent;
+  case N_I32:
+    return node->i32;
+  case N_LOCAL:
+    return rtval_get_i32(frame->slots[node->slot]);
+  case N_INTRINSIC_UNCHECKED:
+    if (intrinsic_kind(node->intrinsic.op) == INTRINSIC_KIND_I32)
+      return eval_i32_bin_intrinsic(node->intrinsic.op, eval_i32(frame, node->intrinsic.a), eval_i32(frame, node->intrinsic.b));
+    return eval_f64_bin_cmp_intrinsic(node->intrinsic.op, eval_f64(frame, node->intrinsic.a), eval_f64(frame, node->intrinsic.b));
+  default:
+    return rtval_get_i32(eval_node(frame, node));
   }
-  assert(false && "lookup: word not found in env");
 }
 
-void update_env_var(local_env_t *env, const word_t *word, rtval_t value)
+// the value of a node the compiler proved to be an f64
+static double eval_f64(const frame_t *frame, const node_t *node)
 {
-  for (int i = env->len; i-- > 0;)
+  switch (node->kind)
   {
-    if (word_eq(env->bindings[i].name, word))
-    {
-      env->bindings[i].value = value;
-      return;
-    }
+  case N_F64:
+    return node->f64;
+  case N_LOCAL:
+    return rtval_get_f64(frame->slots[node->slot]);
+  case N_INTRINSIC_UNCHECKED:
+    return eval_f64_bin_arith_intrinsic(node->intrinsic.op, eval_f64(frame, node->intrinsic.a), eval_f64(frame, node->intrinsic.b));
+  default:
+    return rtval_get_f64(eval_node(frame, node));
   }
-  exitWithError("update_env_var: word not found in env");
 }
 
-rtval_t eval_exp(const local_stack_t *env, const form_t *form)
+// nodes in tail position are evaluated by looping instead of recursing, so a call in tail
+// position takes over the frame of the call this invocation made, stored in *owned_slots
+static rtval_t eval_tail(frame_t frame, const node_t *node, rtval_t **owned_slots)
 {
-  if (form->type == T_WORD)
-    return lookup(env, form->word);
-
-  const form_list_t *list = form->list;
-  check_exit(list->size > 0, "empty list");
-  const word_t *name = try_get_word(list->cells[0]);
-  check_exit(name, "direct form application not implemented");
-  const struct special_form *spec = try_get_wuns_special_form(name->chars, name->size);
-  if (!spec)
-  {
-    rtval_t fn = lookup(env, name);
-    check_exit(fn.tag == rtval_func, "expected function");
-    const rtfunc_t *func = fn.func;
-    const int arity = func->arity;
-    const int numOfArgs = list->size - 1;
-    check_exit(numOfArgs >= arity, "too few arguments");
-    const int numBindings = func->rest_param ? arity + 1 : arity;
-    binding_t *bindings = malloc(sizeof(binding_t) * numBindings);
-    for (int i = 0; i < arity; i++)
-    {
-      const word_t *var = func->params[i];
-      const rtval_t val = eval_exp(env, list->cells[i + 1]);
-      bindings[i] = (binding_t){.name = var, .value = val};
-    }
-    if (func->rest_param)
-    {
-      int numRest = numOfArgs - arity;
-      rtval_list_t *rest = malloc(sizeof(rtval_list_t) + sizeof(rtval_t) * numRest);
-      rest->size = numRest;
-      for (int i = 0; i < numRest; i++)
-        rest->values[i] = eval_exp(env, list->cells[arity + i + 1]);
-      bindings[arity] = (binding_t){.name = func->rest_param, .value = (rtval_t){.tag = rtval_list, .list = rest}};
-    }
-    else
-    {
-      check_exit(numOfArgs == arity, "too many arguments");
-    }
-    const def_env_t *denv = get_def_env(env);
-    const local_stack_t top_env = {.type = ENV_DEF, .def_env = denv};
-    local_env_t new_lenv = {.len = numBindings, .bindings = bindings, .special_form_type = SF_LET};
-    local_stack_t new_stack = {.type = ENV_LOCAL, .frame = &(local_stack_frame_t){.parent = &top_env, .env = &new_lenv}};
-    const form_list_t *bodies = func->bodies;
-    if (bodies->size == 0)
-    {
-      free(bindings);
-      return (rtval_t){.tag = rtval_undefined, .i32 = 0};
-    }
-    for (size_t i = 0; i < bodies->size - 1; i++)
-      eval_exp(&new_stack, bodies->cells[i]);
-    const rtval_t result = eval_exp(&new_stack, bodies->cells[bodies->size - 1]);
-    free(bindings);
-    return result;
-  }
-  switch (spec->type)
-  {
-  case SF_I32:
+  for (;;)
   {
-    check_exit(list->size == 2, "i32 requires exactly one argument");
-    const word_t *arg_word = get_word(list->cells[1]);
-    const int32_t arg_val = parse_i32(arg_word->chars);
-    return (rtval_t){.tag = rtval_i32, .i32 = arg_val};
-  }
-  case SF_F64:
-  {
-    check_exit(list->size == 2, "f64 requires exactly one argument");
-    const word_t *arg_word = get_word(list->cells[1]);
-    const double arg_val = parse_f64(arg_word->chars);
-    return (rtval_t){.tag = rtval_f64, .f64 = arg_val};
-  }
-  case SF_INTRINSIC:
-  {
-    check_exit(list->size > 1, "intrinsic requires at least one argument");
-    const word_t *arg_word = get_word(list->cells[1]);
-    const struct intrinsic *intrinsic = try_get_wuns_intrinsic(arg_word->chars, arg_word->size);
-    check_exit(intrinsic, "unknown intrinsic");
-    switch (intrinsic->type)
+    switch (node->kind)
     {
-    case INTRINSIC_I32_ADD:
-    case INTRINSIC_I32_SUB:
-    case INTRINSIC_I32_MUL:
-    case INTRINSIC_I32_DIV_S:
-    case INTRINSIC_I32_REM_S:
-
-    case INTRINSIC_I32_EQ:
-    case INTRINSIC_I32_NE:
-    case INTRINSIC_I32_LT_S:
-    case INTRINSIC_I32_GT_S:
-    case INTRINSIC_I32_LE_S:
-    case INTRINSIC_I32_GE_S:
-
-    case INTRINSIC_I32_AND:
-    case INTRINSIC_I32_OR:
-    case INTRINSIC_I32_XOR:
-    case INTRINSIC_I32_SHL:
-    case INTRINSIC_I32_SHR_S:
-    case INTRINSIC_I32_SHR_U:
+    case N_I32:
+      return rtval_make_i32(node->i32);
+    case N_F64:
+      return rtval_make_f64(node->f64);
+    case N_FORM:
+      return rtval_make_form(node->form);
+    case N_LOCAL:
+      return frame.slots[node->slot];
+    case N_GLOBAL:
     {
-      check_exit(list->size == 4, "intrinsic requires exactly two arguments");
-      const rtval_t arg1 = eval_exp(env, list->cells[2]);
-      const rtval_t arg2 = eval_exp(env, list->cells[3]);
-      check_exit(arg1.tag == rtval_i32 && arg2.tag == rtval_i32, "intrinsic requires i32 arguments");
-      return (rtval_t){.tag = rtval_i32, .i32 = eval_i32_bin_intrinsic(intrinsic->type, arg1.i32, arg2.i32)};
+      const rtval_t val = frame.def_env->bindings[node->slot].value;
+      // slots are reserved when referenced, so a reference may precede its definition
+      check_exit(rtval_get_tag(val) != rtval_undefined, "word not found in env");
+      return val;
     }
-    case INTRINSIC_F64_ADD:
-    case INTRINSIC_F64_SUB:
-    case INTRINSIC_F64_MUL:
-    case INTRINSIC_F64_DIV:
+    case N_INTRINSIC:
     {
-      check_exit(list->size == 4, "intrinsic requires exactly two arguments");
-      const rtval_t arg1 = eval_exp(env, list->cells[2]);
-      const rtval_t arg2 = eval_exp(env, list->cells[3]);
-      check_exit(arg1.tag == rtval_f64 && arg2.tag == rtval_f64, "intrinsic requires f64 arguments");
-      return (rtval_t){.tag = rtval_f64, .f64 = eval_f64_bin_arith_intrinsic(intrinsic->type, arg1.f64, arg2.f64)};
+      const rtval_t arg1 = eval_node(&frame, node->intrinsic.a);
+      const rtval_t arg2 = eval_node(&frame, node->intrinsic.b);
+      const intrinsic_type_t op = node->intrinsic.op;
+      switch (intrinsic_kind(op))
+      {
+      case INTRINSIC_KIND_I32:
+        check_exit(rtval_get_tag(arg1) == rtval_i32 && rtval_get_tag(arg2) == rtval_i32, "intrinsic requires i32 arguments");
+        return rtval_make_i32(eval_i32_bin_intrinsic(op, rtval_get_i32(arg1), rtval_get_i32(arg2)));
+      case INTRINSIC_KIND_F64_ARITH:
+        check_exit(rtval_get_tag(arg1) == rtval_f64 && rtval_get_tag(arg2) == rtval_f64, "intrinsic requires f64 arguments");
+        return rtval_make_f64(eval_f64_bin_arith_intrinsic(op, rtval_get_f64(arg1), rtval_get_f64(arg2)));
+      case INTRINSIC_KIND_F64_CMP:
+        check_exit(rtval_get_tag(arg1) == rtval_f64 && rtval_get_tag(arg2) == rtval_f64, "intrinsic requires f64 arguments");
+        return rtval_make_i32(eval_f64_bin_cmp_intrinsic(op, rtval_get_f64(arg1), rtval_get_f64(arg2)));
+      }
+      exitWithError("unknown intrinsic");
     }
-    case INTRINSIC_F64_EQ:
-    case INTRINSIC_F64_NE:
-    case INTRINSIC_F64_LT:
-    case INTRINSIC_F64_GT:
-    case INTRINSIC_F64_LE:
-    case INTRINSIC_F64_GE:
+    case N_INTRINSIC_UNCHECKED:
+      if (node->type == TYPE_I32)
+        return rtval_make_i32(eval_i32(&frame, node));
+      return rtval_make_f64(eval_f64(&frame, node));
+    case N_CHECK:
     {
-      check_exit(list->size == 4, "intrinsic requires exactly two arguments");
-      const rtval_t arg1 = eval_exp(env, list->cells[2]);
-      const rtval_t arg2 = eval_exp(env, list->cells[3]);
-      check_exit(arg1.tag == rtval_f64 && arg2.tag == rtval_f64, "intrinsic requires f64 arguments");
-      return (rtval_t){.tag = rtval_i32, .i32 = eval_f64_bin_cmp_intrinsic(intrinsic->type, arg1.f64, arg2.f64)};
-    }
+      const rtval_t val = eval_node(&frame, node->check.value);
+      check_exit(rtval_get_tag(val) == value_type_tag(node->type), "value does not have its annotated type");
+      return val;
     }
-  }
-  case SF_IF:
-  {
-    check_exit(list->size == 4, "if requires exactly three arguments");
-    const rtval_t cond = eval_exp(env, list->cells[1]);
-    check_exit(cond.tag == rtval_i32, "if requires i32 condition");
-    return eval_exp(env, list->cells[cond.i32 ? 2 : 3]);
-  }
-  case SF_DO:
-  {
-    if (list->size == 1)
-      return (rtval_t){.tag = rtval_undefined, .i32 = 0};
-    for (size_t i = 1; i < list->size - 1; i++)
-      eval_exp(env, list->cells[i]);
-    return eval_exp(env, list->cells[list->size - 1]);
-  }
-  case SF_LET:
-  {
-    check_exit(list->size >= 2, "let requires at least two arguments");
-    const form_list_t *bindingForms = get_list(list->cells[1]);
-    check_exit(bindingForms->size % 2 == 0, "let bindings must be a list of even length");
-    const int number_of_bindings = bindingForms->size / 2;
-    binding_t *bindingVals = malloc(sizeof(binding_t) * number_of_bindings);
-    local_env_t new_lenv = {.len = 0, .bindings = bindingVals, .special_form_type = SF_LET};
-    local_stack_t new_stack = {.type = ENV_LOCAL, .frame = &(local_stack_frame_t){.parent = env, .env = &new_lenv}};
-    for (int i = 0; i < number_of_bindings; i++)
+    case N_IF:
     {
-      const word_t *var = get_word(bindingForms->cells[i * 2]);
-      const rtval_t val = eval_exp(&new_stack, bindingForms->cells[i * 2 + 1]);
-      bindingVals[i] = (binding_t){.name = var, .value = val};
-      new_lenv.len++;
+      int32_t cond;
+      if (node->if_.cond->type == TYPE_I32)
+      {
+        cond = eval_i32(&frame, node->if_.cond);
+      }
+      else
+      {
+        const rtval_t val = eval_node(&frame, node->if_.cond);
+        check_exit(rtval_get_tag(val) == rtval_i32, "if requires i32 condition");
+        cond = rtval_get_i32(val);
+      }
+      node = cond ? node->if_.then : node->if_.otherwise;
+      continue;
     }
-    if (list->size == 2)
-      return (rtval_t){.tag = rtval_undefined, .i32 = 0};
-    for (size_t i = 2; i < list->size - 1; i++)
-      eval_exp(&new_stack, list->cells[i]);
-    const rtval_t res = eval_exp(&new_stack, list->cells[list->size - 1]);
-    free(bindingVals);
-    return res;
-  }
-  case SF_LOOP:
-  {
-    check_exit(list->size >= 2, "let requires at least two arguments");
-    const form_list_t *bindingForms = get_list(list->cells[1]);
-    check_exit(bindingForms->size % 2 == 0, "let bindings must be a list of even length");
-    const int number_of_bindings = bindingForms->size / 2;
-    binding_t *bindingVals = malloc(sizeof(binding_t) * number_of_bindings);
-    local_env_t new_lenv = {.len = 0, .bindings = bindingVals, .special_form_type = SF_LOOP};
-    local_stack_t new_stack = {.type = ENV_LOCAL, .frame = &(local_stack_frame_t){.parent = env, .env = &new_lenv}};
-    for (int i = 0; i < number_of_bindings; i++)
+    case N_DO:
     {
-      const word_t *var = get_word(bindingForms->cells[i * 2]);
-      const rtval_t val = eval_exp(&new_stack, bindingForms->cells[i * 2 + 1]);
-      bindingVals[i] = (binding_t){.name = var, .value = val};
-      new_lenv.len++;
+      const size_t size = node->seq.size;
+      if (size == 0)
+        return rtval_make_undefined();
+      for (size_t i = 0; i < size - 1; i++)
+        eval_node(&frame, node->seq.exps[i]);
+      node = node->seq.exps[size - 1];
+      continue;
     }
-    if (list->size == 2)
-      return (rtval_t){.tag = rtval_undefined, .i32 = 0};
-    while (1)
+    case N_LET:
+      for (size_t i = 0; i < node->let.size; i++)
+        frame.slots[node->let.bindings[i].slot] = eval_node(&frame, node->let.bindings[i].value);
+      node = node->let.body;
+      continue;
+    case N_LOOP:
     {
-      for (size_t i = 2; i < list->size - 1; i++)
-        eval_exp(&new_stack, list->cells[i]);
-      rtval_t res = eval_exp(&new_stack, list->cells[list->size - 1]);
-      if (res.tag == rtval_continue)
+      for (size_t i = 0; i < node->let.size; i++)
+        frame.slots[node->let.bindings[i].slot] = eval_node(&frame, node->let.bindings[i].value);
+      if (node->let.jump_continues)
+      {
+        // continues jump back to the body, so it is in tail position
+        node = node->let.body;
         continue;
-      free(bindingVals);
+      }
+      // the body is not in tail position, its value is checked for continue
+      rtval_t res = eval_node(&frame, node->let.body);
+      while (rtval_get_tag(res) == rtval_continue)
+        res = eval_node(&frame, node->let.body);
       return res;
     }
-  }
-  case SF_CONTINUE:
-  {
-    check_exit(list->size % 2 != 0, "continue requires an even number of arguments");
-    local_env_t *loop_env = get_outer_loop(env);
-    check_exit(loop_env, "continue not in loop");
-    for (size_t i = 1; i < list->size; i += 2)
+    case N_CONTINUE:
     {
-      const word_t *var = get_word(list->cells[i]);
-      const rtval_t val = eval_exp(env, list->cells[i + 1]);
-      update_env_var(loop_env, var, val);
+      for (size_t i = 0; i < node->cont.size; i++)
+        frame.slots[node->cont.bindings[i].slot] = eval_node(&frame, node->cont.bindings[i].value);
+      if (node->cont.loop != nullptr)
+      {
+        node = node->cont.loop->let.body;
+        continue;
+      }
+      return rtval_make_continue();
     }
-    return (rtval_t){.tag = rtval_continue};
-  }
-  case SF_SWITCH:
-  {
-    check_exit(list->size >= 3, "switch requires at least two arguments");
-    check_exit(list->size % 2 != 0, "switch requires an odd number of arguments");
-    const rtval_t cond = eval_exp(env, list->cells[1]);
-    for (size_t i = 2; i < list->size - 1; i += 2)
+    case N_SWITCH:
     {
-      const form_list_t *case_values = get_list(list->cells[i]);
-      for (size_t j = 0; j < case_values->size; j++)
+      const rtval_t cond = eval_node(&frame, node->switch_.value);
+      const node_t *body = node->switch_.default_case;
+      if (node->switch_.table != nullptr)
       {
-        const rtval_t case_val = eval_exp(env, case_values->cells[j]);
-        if (case_val.tag != cond.tag)
-          continue;
-        switch (case_val.tag)
+        // the case values are i32 literals, so other values go to the default
+        const int case_index = rtval_get_tag(cond) == rtval_i32 ? switch_table_lookup(node->switch_.table, rtval_get_i32(cond)) : -1;
+        node = case_index < 0 ? body : node->switch_.cases[case_index].body;
+        continue;
+      }
+      bool matched = false;
+      for (size_t i = 0; i < node->switch_.size && !matched; i++)
+      {
+        const switch_case_t *switch_case = &node->switch_.cases[i];
+        for (size_t j = 0; j < switch_case->size; j++)
         {
-        case rtval_i32:
-          if (case_val.i32 == cond.i32)
-            return eval_exp(env, list->cells[i + 1]);
-          break;
-        case rtval_f64:
+          const rtval_t case_val = eval_node(&frame, switch_case->values[j]);
+          if (rtval_get_tag(case_val) != rtval_get_tag(cond))
+            continue;
           // maybe only allow i32...
-          if (case_val.f64 == cond.f64)
-            return eval_exp(env, list->cells[i + 1]);
-          break;
-        default:
-          break;
+          if ((rtval_get_tag(case_val) == rtval_i32 && rtval_get_i32(case_val) == rtval_get_i32(cond)) ||
+              (rtval_get_tag(case_val) == rtval_f64 && rtval_get_f64(case_val) == rtval_get_f64(cond)))
+          {
+            body = switch_case->body;
+            matched = true;
+            break;
+          }
         }
       }
+      node = body;
+      continue;
     }
-    const form_t *default_case = list->cells[list->size - 1];
-    return eval_exp(env, default_case);
-  }
-  case SF_LETFN:
-  case SF_TYPE_ANNO:
-  case SF_FUNC:
-  case SF_WORD:
-  {
-    exitWithError("not implemented");
-  }
-  case SF_DEF:
-  case SF_DEFN:
-  case SF_DEFEXPR:
-  case SF_DEFMACRO:
-  case SF_LOAD:
-  case SF_TYPE:
-  case SF_IMPORT:
-  case SF_EXPORT:
-    exitWithError("unexpected top special form in exp");
-  default:
-    printf("unknown special form: %s\n", name->chars);
-    exitWithError("unknown special form");
-    exit(1);
+    case N_CALL:
+    {
+      rtval_t fn = eval_node(&frame, node->call.fn);
+      check_exit(rtval_get_tag(fn) == rtval_func, "expected function");
+      const rtfunc_t *func = rtval_get_func(fn);
+      const int arity = func->arity;
+      const int numOfArgs = node->call.size;
+      check_exit(numOfArgs >= arity, "too few arguments");
+      value_stack_t *stack = &frame.def_env->stack;
+      // arguments may call functions too, their frames go above the arguments evaluated so far,
+      // the frame grows as they are set so the collector never scans a slot that is not
+      rtval_t *slots = stack->top;
+      check_exit(stack->end - slots >= func->frame_size, "stack overflow");
+      for (int i = 0; i < arity; i++)
+      {
+        slots[i] = eval_node(&frame, node->call.args[i]);
+        stack->top = slots + i + 1;
+      }
+      value_stack_push(stack, func->frame_size - arity);
+      if (func->rest_unread)
+      {
+        // the rest slot stays undefined, the arguments are still evaluated for their errors
+        for (size_t i = arity; i < node->call.size; i++)
+          eval_node(&frame, node->call.args[i]);
+      }
+      else if (func->has_rest)
+      {
+        int numRest = numOfArgs - arity;
+        // in the frame before the values are evaluated, so a collection while evaluating them keeps it
+        rtval_list_t *rest = gc_alloc_list(frame.def_env, numRest);
+        slots[arity] = rtval_make_list(rest);
+        for (int i = 0; i < numRest; i++)
+          rest->values[i] = eval_node(&frame, node->call.args[arity + i]);
+      }
+      else
+      {
+        check_exit(numOfArgs == arity, "too many arguments");
+      }
+      if (*owned_slots != nullptr)
+      {
+        // the frame of an earlier call is done, move the arguments down over it
+        memmove(*owned_slots, slots, sizeof(rtval_t) * func->frame_size);
+        slots = *owned_slots;
+        value_stack_pop(stack, slots + func->frame_size);
+      }
+      *owned_slots = slots;
+      frame.slots = slots;
+      node = func->body;
+      continue;
+    }
+    case N_DEF:
+    case N_DEFN:
+      exitWithError("unexpected top special form in exp");
+    }
+    exitWithError("unknown node");
   }
 }
 
-const form_t *form_copy(const form_t *form);
+rtval_t eval_node(const frame_t *frame, const node_t *node)
+{
+  rtval_t *owned_slots = nullptr;
+  const rtval_t result = eval_tail(*frame, node, &owned_slots);
+  if (owned_slots != nullptr)
+    value_stack_pop(&frame->def_env->stack, owned_slots);
+  return result;
+}
 
-form_list_t *form_list_slice_copy(const form_list_t *list, size_t start, size_t end)
+rtval_t eval_tree(def_env_t *denv, const node_t *node, int frame_size)
 {
-  assert(start <= end && "invalid slice");
-  assert(end <= list->size && "invalid slice");
-  const size_t size = end - start;
-  form_list_t *new_list = malloc(sizeof(form_list_t) + sizeof(form_t *) * size);
-  new_list->size = size;
-  for (size_t i = 0; i < size; i++)
-    new_list->cells[i] = form_copy(list->cells[start + i]);
-  return new_list;
+  value_stack_init(denv);
+  rtval_t *slots = value_stack_push(&denv->stack, frame_size);
+  const frame_t frame = {.def_env = denv, .slots = slots};
+  const rtval_t result = eval_node(&frame, node);
+  value_stack_pop(&denv->stack, slots);
+  return result;
 }
 
-const form_t *form_copy(const form_t *form)
+// evaluate a compiled top-level expression with the environment's engine
+static rtval_t eval_compiled(def_env_t *denv, const node_t *node, int frame_size)
 {
-  switch (form->type)
+  if (denv->engine != ENGINE_TREE)
   {
-  case T_WORD:
-    return form_word_alloc(word_copy(form->word));
-  case T_LIST:
-    return form_list_alloc(form_list_slice_copy(form->list, 0, form->list->size));
+    if (denv->vm == nullptr)
+      denv->vm = vm_create(denv->allocator);
+    return vm_run(denv->vm, denv, bytecode_compile(&denv->scratch, node, frame_size));
   }
-  assert(false && "unreachable");
+  return eval_tree(denv, node, frame_size);
+}
+
+rtval_t define_func(def_env_t *denv, const node_t *defn)
+{
+  rtfunc_t func = (rtfunc_t){
+      .name = defn->defn.name,
+      .arity = defn->defn.arity,
+      .has_rest = defn->defn.has_rest,
+      .rest_unread = defn->defn.rest_unread,
+      .frame_size = defn->defn.frame_size,
+      .body = defn->defn.body,
+      .is_macro = defn->defn.is_macro,
+      .arena = defn->defn.arena};
+  rtfunc_t *funcp = gc_alloc_func(denv);
+  memcpy(funcp, &func, sizeof(rtfunc_t));
+  rtval_t result = rtval_make_func(funcp);
+  // the old value is collected once nothing else references it
+  denv->bindings[defn->defn.slot].value = result;
+  return result;
 }
 
 rtval_t eval_top(def_env_t *denv, const form_t *form)
 {
-  const local_stack_t *env = &(local_stack_t){.type = ENV_DEF, .def_env = denv};
-  if (form->type == T_LIST)
+  int frame_size;
+  const node_t *node = compile_top(denv, form, &frame_size);
+  switch (node->kind)
   {
-    const form_list_t *list = form->list;
-    if (list->size > 0)
-    {
-      const word_t *name = try_get_word(list->cells[0]);
-      if (name != nullptr)
-      {
-        const struct special_form *spec = try_get_wuns_special_form(name->chars, name->size);
-        if (spec != nullptr)
-        {
-          switch (spec->type)
-          {
-          case SF_DEF:
-          {
-            check_exit(list->size == 3, "def requires exactly two arguments");
-            const word_t *var = get_word(list->cells[1]);
-            const word_t *cvar = word_copy(var);
-            const rtval_t val = eval_exp(env, list->cells[2]);
-            def_env_set(denv, cvar, val);
-            return val;
-          }
-          case SF_DEFN:
-          {
-            check_exit(list->size >= 3, "defn requires at least three arguments");
-            const word_t *fname = get_word(list->cells[1]);
-            const form_list_t *paramForms = get_list(list->cells[2]);
-            const word_t **params;
-            const word_t *rest_param = nullptr;
-            int arity;
-            if (paramForms->size > 1 && strncmp(get_word(paramForms->cells[paramForms->size - 2])->chars, "..", 2) == 0)
-            {
-              arity = paramForms->size - 2;
-              params = malloc(sizeof(word_t *) * arity);
-              for (int i = 0; i < arity; i++)
-              {
-                params[i] = word_copy(get_word(paramForms->cells[i]));
-              }
-              rest_param = word_copy(get_word(paramForms->cells[paramForms->size - 1]));
-            }
-            else
-            {
-              arity = paramForms->size;
-              params = malloc(sizeof(word_t *) * arity);
-              for (int i = 0; i < arity; i++)
-              {
-                params[i] = word_copy(get_word(paramForms->cells[i]));
-              }
-            }
-            const form_list_t *bodies = form_list_slice_copy(list, 3, list->size);
-            rtfunc_t func = (rtfunc_t){
-                .name = word_copy(fname),
-                .arity = arity,
-                .params = (const word_t **)params,
-                .rest_param = rest_param,
-                .bodies = bodies};
-            rtfunc_t *funcp = malloc(sizeof(rtfunc_t));
-            memcpy(funcp, &func, sizeof(rtfunc_t));
-            rtval_t result = (rtval_t){.tag = rtval_func, .func = funcp};
-            def_env_set(denv, fname, result);
-            return result;
-          }
-          case SF_DEFEXPR:
-          case SF_DEFMACRO:
-          case SF_LOAD:
-          case SF_TYPE:
-          case SF_IMPORT:
-          case SF_EXPORT:
-          {
-            exitWithError("not implemented");
-          }
+  case N_DEF:
+  {
+    const rtval_t val = eval_compiled(denv, node->def.value, frame_size);
+    denv->bindings[node->def.slot].value = val;
+    return val;
+  }
+  case N_DEFN:
+    return define_func(denv, node);
+  default:
+    return eval_compiled(denv, node, frame_size);
+  }
+}
 
-          default:
-          {
-            return eval_exp(env, form);
-          }
-          }
-        }
-      }
-    }
+void def_env_init(def_env_t *denv, engine_t engine, const allocator_t *allocator)
+{
+  pool_t *pool = nullptr;
+  if (allocator == nullptr)
+  {
+    pool = pool_create();
+    allocator = pool_get_allocator(pool);
   }
-  return eval_exp(env, form);
+  *denv = (def_env_t){
+      .capacity = INIT_BINDINGS_CAPACITY,
+      .bindings = allocator_alloc(allocator, sizeof(binding_t) * INIT_BINDINGS_CAPACITY),
+      .engine = engine,
+      .allocator = allocator,
+      .pool = pool,
+      .arena = {.allocator = allocator},
+      .scratch = {.allocator = allocator},
+  };
+}
+
+void def_env_free(def_env_t *denv)
+{
+  allocator_free(denv->allocator, denv->bindings, sizeof(binding_t) * denv->capacity);
+  allocator_free(denv->allocator, denv->word_slots, sizeof(int) * denv->word_slots_capacity);
+  allocator_free(denv->allocator, denv->word_forms, sizeof(form_t *) * denv->word_forms_capacity);
+  if (denv->stack.values != nullptr)
+    allocator_free(denv->allocator, denv->stack.values, sizeof(rtval_t) * VALUE_STACK_SIZE);
+  vm_free(denv->vm);
+  gc_free(denv);
+  arena_free(&denv->arena);
+  arena_free(&denv->scratch);
+  pool_destroy(denv->pool);
 }
 
+// the returned form is only valid until the next call
 const form_t *parse_one_string(const char *start)
 {
+  static arena_t arena = {0};
+  static parser_t *parser = nullptr;
+  if (parser == nullptr)
+    parser = parser_create(&arena, nullptr, nullptr);
+  arena_reset(&arena);
   const char *end = start + strlen(start);
-  const form_t *form = parse_one(&start, end);
+  const form_t *form = parse_one(parser, &start, end);
   assert(form && "no form parsed");
   print_form(form);
   return form;
@@ -996,20 +853,23 @@ const form_t *parse_one_string(const char *start)
 rtval_t *parse_eval(const char *start)
 {
   const form_t *form = parse_one_string(start);
-  const int initial_capacity = 1;
-  binding_t *defBindings = malloc(sizeof(binding_t) * initial_capacity);
-  def_env_t denv = (def_env_t){.size = 0, .capacity = initial_capacity, .bindings = defBindings};
-  const local_stack_t env = {.type = ENV_DEF, .def_env = &denv};
-  const rtval_t result = eval_exp(&env, form);
+  // the result is released to the host, so it must not come from a pool destroyed with the environment
+  def_env_t denv;
+  def_env_init(&denv, ENGINE_VM, &malloc_allocator);
+  int frame_size;
+  const node_t *node = compile_exp(&denv, &denv.scratch, form, &frame_size);
+  const rtval_t result = eval_compiled(&denv, node, frame_size);
   rtval_t *result_ptr = malloc(sizeof(rtval_t));
   memcpy(result_ptr, &result, sizeof(rtval_t));
-  free(defBindings);
+  // the host reads the result after the environment is gone
+  gc_release(&denv, result);
+  def_env_free(&denv);
   return result_ptr;
 }
 
 const char *get_type(rtval_t *val)
 {
-  switch (val->tag)
+  switch (rtval_get_tag(*val))
   {
   case rtval_i32:
     return "i32";
@@ -1023,6 +883,8 @@ const char *get_type(rtval_t *val)
     return "func";
   case rtval_list:
     return "list";
+  case rtval_form:
+    return "form";
   default:
     return "unknown";
   }
@@ -1030,13 +892,13 @@ const char *get_type(rtval_t *val)
 
 double get_f64(rtval_t *val)
 {
-  switch (val->tag)
+  switch (rtval_get_tag(*val))
   {
   case rtval_f64:
-    return val->f64;
+    return rtval_get_f64(*val);
     break;
   case rtval_i32:
-    return val->i32;
+    return rtval_get_i32(*val);
     break;
 
   default:
@@ -1046,10 +908,10 @@ double get_f64(rtval_t *val)
 
 int32_t rt_get_size(rtval_t *val)
 {
-  switch (val->tag)
+  switch (rtval_get_tag(*val))
   {
   case rtval_list:
-    return val->list->size;
+    return rtval_get_list(*val)->size;
   default:
     assert(false && "expected list");
   }
@@ -1057,12 +919,12 @@ int32_t rt_get_size(rtval_t *val)
 
 rtval_t *rt_get_list(rtval_t *val, int index)
 {
-  switch (val->tag)
+  switch (rtval_get_tag(*val))
   {
   case rtval_list:
     assert(index >= 0 && "index out of bounds");
-    assert(index < (int)val->list->size && "index out of bounds");
-    return &val->list->values[index];
+    assert(index < (int)rtval_get_list(*val)->size && "index out of bounds");
+    return &rtval_get_list(*val)->values[index];
   default:
     assert(false && "expected list");
   }
@@ -1070,21 +932,26 @@ rtval_t *rt_get_list(rtval_t *val, int index)
 
 rtval_t *parse_eval_top_forms(const char *start)
 {
-  const int initial_capacity = 128;
-  binding_t *defBindings = malloc(sizeof(binding_t) * initial_capacity);
-  def_env_t denv = (def_env_t){.size = 0, .capacity = initial_capacity, .bindings = defBindings};
+  // the result is released to the host, so it must not come from a pool destroyed with the environment
+  def_env_t denv;
+  def_env_init(&denv, ENGINE_VM, &malloc_allocator);
   const char *end = start + strlen(start);
   const char **cur = &start;
-  rtval_t result = (rtval_t){.tag = rtval_undefined, .i32 = 0};
+  arena_t forms = {.allocator = denv.allocator};
+  parser_t *parser = parser_create(&forms, nullptr, nullptr);
+  rtval_t result = rtval_make_undefined();
   while (start < end)
   {
-    const form_t *form = parse_one(cur, end);
+    const form_t *form = parse_one(parser, cur, end);
     if (!form)
       break;
     result = eval_top(&denv, form);
-    form_free((form_t *)form);
+    arena_reset(&forms);
   }
-  free(defBindings);
+  parser_free(parser);
+  arena_free(&forms);
+  gc_release(&denv, result);
+  def_env_free(&denv);
   rtval_t *result_ptr = malloc(sizeof(rtval_t));
   memcpy(result_ptr, &result, sizeof(rtval_t));
   return result_ptr;
@@ -1,11 +1,71 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// where the memory of an environment and its parsers comes from, a host may pass its own to
+// account for it or pool it, sizes are passed back on realloc and free so no block needs a header
+typedef struct allocator
+{
+  void *(*alloc)(void *ctx, size_t size);
+  void *(*realloc)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+  void (*free)(void *ctx, void *ptr, size_t size);
+  void *ctx;
+} allocator_t;
+
+// the C heap, used wherever no allocator is given
+extern const allocator_t malloc_allocator;
+
+// size-class free lists over slabs that all go back to malloc when the pool is destroyed,
+// a pool is not locked so it is used from one thread at a time
+typedef struct pool pool_t;
+pool_t *pool_create(void);
+const allocator_t *pool_get_allocator(pool_t *pool);
+void pool_destroy(pool_t *pool);
+
+// allocator may be nullptr for malloc, running out of memory is an error
+void *allocator_alloc(const allocator_t *allocator, size_t size);
+void *allocator_realloc(const allocator_t *allocator, void *ptr, size_t old_size, size_t new_size);
+void allocator_free(const allocator_t *allocator, void *ptr, size_t size);
+
+typedef struct arena_chunk
+{
+  struct arena_chunk *next;
+  size_t capacity;
+  size_t used;
+  max_align_t data[];
+} arena_chunk_t;
+
+// bump allocator, everything allocated from it is released at once
+typedef struct
+{
+  arena_chunk_t *head;
+  // the chunks come from here, nullptr for malloc
+  const allocator_t *allocator;
+} arena_t;
+
+void *arena_alloc(arena_t *arena, size_t size);
+void arena_reset(arena_t *arena);
+void arena_free(arena_t *arena);
+
+// words are interned, two words are equal iff they have the same id
 typedef struct
 {
+  uint32_t id;
   uint8_t size;
   char chars[];
 } word_t;
 
+const word_t *word_intern(const char *start, const size_t size);
+bool word_eq(const word_t *a, const word_t *b);
+
+void exitWithError(const char *message);
+
+#define check_exit(cond, message) \
+  if (!(cond))                    \
+  exitWithError(message)
+
 typedef struct
 {
   size_t size;
@@ -26,7 +86,24 @@ typedef struct form
   };
 } form_t;
 
-const form_t *parse_one(const char **start, const char *end);
+// called for every completed top-level form, return false to stop parsing
+// the arena may be reset from the callback as no partial form is pending then
+typedef bool (*form_callback_t)(void *ctx, const form_t *form);
+
+// parser context for input arriving in chunks, forms are allocated from arena
+// the nesting stack is kept between calls, so depth is only limited by memory
+typedef struct parser parser_t;
+
+// on_form may be nullptr if the parser is only used through parse_one
+parser_t *parser_create(arena_t *arena, form_callback_t on_form, void *ctx);
+void parser_free(parser_t *parser);
+// parse [*start, end), keeping partial forms and words for the next call
+// returns false if stopped by the callback or an unmatched ']', *start is set to where parsing stopped
+bool parser_feed(parser_t *parser, const char **start, const char *end);
+// end of input, emits a pending word and closes open lists
+void parser_finish(parser_t *parser);
+// parse the first form in [*start, end), treating end as the end of input
+const form_t *parse_one(parser_t *parser, const char **start, const char *end);
 void print_form(const form_t *form);
 
 
@@ -36,6 +113,8 @@ typedef enum
   rtval_f64,
   rtval_func,
   rtval_list,
+  // code as data, the arguments and results of macros
+  rtval_form,
   // pseudo-values not meant to be returned
   rtval_undefined,
   rtval_continue,
@@ -45,11 +124,87 @@ typedef struct
 {
   const word_t *name;
   const int arity;
-  const word_t **params;
-  const word_t *rest_param;
-  const form_list_t *bodies;
+  const bool has_rest;
+  // the rest list cannot escape as the body never reads it, calls evaluate the extra arguments
+  // and leave the rest slot undefined instead of allocating the list
+  const bool rest_unread;
+  // number of local slots, arguments take the first ones
+  const int frame_size;
+  const struct node *body;
+  // called by the compiler with the forms of its arguments, the form it returns is compiled in place of the call
+  const bool is_macro;
+  // compiled on the first call by the vm
+  const struct bytecode *code;
+  // native code for the argument tags of the first call with the jit engine,
+  // nullptr if it has not been tried or the body is not supported
+  const struct jit_code *jit;
+  bool jit_tried;
+  // the nodes and bytecode of the body, freed with the function
+  arena_t arena;
 } rtfunc_t;
 
+// values are only accessed through the rtval_make_ and rtval_get_ functions below,
+// so their representation can be chosen at build time
+struct rtval_list;
+
+#ifdef RTVAL_NAN_BOXING
+
+#include <string.h>
+
+// 8 bytes, f64 values are stored as is with every nan made the same positive quiet nan,
+// the negative quiet nans carry the tag in bits 48-50 and an i32 or pointer in the low 48 bits
+typedef struct
+{
+  uint64_t bits;
+} rtval_t;
+
+#define RTVAL_BOX_MASK 0xfff8000000000000ull
+#define RTVAL_CANONICAL_NAN 0x7ff8000000000000ull
+#define RTVAL_PAYLOAD_MASK 0x0000ffffffffffffull
+
+static inline rtval_t rtval_box(rtval_tag tag, uint64_t payload)
+{
+  return (rtval_t){.bits = RTVAL_BOX_MASK | (uint64_t)tag << 48 | payload};
+}
+
+static inline rtval_tag rtval_get_tag(rtval_t v)
+{
+  if ((v.bits & RTVAL_BOX_MASK) != RTVAL_BOX_MASK)
+    return rtval_f64;
+  return (rtval_tag)((v.bits >> 48) & 7);
+}
+
+static inline rtval_t rtval_make_i32(int32_t i) { return rtval_box(rtval_i32, (uint32_t)i); }
+static inline rtval_t rtval_make_func(rtfunc_t *func) { return rtval_box(rtval_func, (uintptr_t)func); }
+static inline rtval_t rtval_make_list(struct rtval_list *list) { return rtval_box(rtval_list, (uintptr_t)list); }
+static inline rtval_t rtval_make_form(const form_t *form) { return rtval_box(rtval_form, (uintptr_t)form); }
+static inline rtval_t rtval_make_undefined(void) { return rtval_box(rtval_undefined, 0); }
+static inline rtval_t rtval_make_continue(void) { return rtval_box(rtval_continue, 0); }
+
+static inline rtval_t rtval_make_f64(double f)
+{
+  rtval_t v;
+  if (f != f)
+    v.bits = RTVAL_CANONICAL_NAN;
+  else
+    memcpy(&v.bits, &f, sizeof(double));
+  return v;
+}
+
+static inline int32_t rtval_get_i32(rtval_t v) { return (int32_t)(uint32_t)v.bits; }
+static inline rtfunc_t *rtval_get_func(rtval_t v) { return (rtfunc_t *)(uintptr_t)(v.bits & RTVAL_PAYLOAD_MASK); }
+static inline struct rtval_list *rtval_get_list(rtval_t v) { return (struct rtval_list *)(uintptr_t)(v.bits & RTVAL_PAYLOAD_MASK); }
+static inline const form_t *rtval_get_form(rtval_t v) { return (const form_t *)(uintptr_t)(v.bits & RTVAL_PAYLOAD_MASK); }
+
+static inline double rtval_get_f64(rtval_t v)
+{
+  double f;
+  memcpy(&f, &v.bits, sizeof(double));
+  return f;
+}
+
+#else
+
 typedef struct
 {
   rtval_tag tag;
@@ -59,9 +214,28 @@ typedef struct
     double f64;
     rtfunc_t *func;
     struct rtval_list *list;
+    const form_t *form;
   };
 } rtval_t;
 
+static inline rtval_tag rtval_get_tag(rtval_t v) { return v.tag; }
+
+static inline rtval_t rtval_make_i32(int32_t i) { return (rtval_t){.tag = rtval_i32, .i32 = i}; }
+static inline rtval_t rtval_make_f64(double f) { return (rtval_t){.tag = rtval_f64, .f64 = f}; }
+static inline rtval_t rtval_make_func(rtfunc_t *func) { return (rtval_t){.tag = rtval_func, .func = func}; }
+static inline rtval_t rtval_make_list(struct rtval_list *list) { return (rtval_t){.tag = rtval_list, .list = list}; }
+static inline rtval_t rtval_make_form(const form_t *form) { return (rtval_t){.tag = rtval_form, .form = form}; }
+static inline rtval_t rtval_make_undefined(void) { return (rtval_t){.tag = rtval_undefined, .i32 = 0}; }
+static inline rtval_t rtval_make_continue(void) { return (rtval_t){.tag = rtval_continue, .i32 = 0}; }
+
+static inline int32_t rtval_get_i32(rtval_t v) { return v.i32; }
+static inline double rtval_get_f64(rtval_t v) { return v.f64; }
+static inline rtfunc_t *rtval_get_func(rtval_t v) { return v.func; }
+static inline struct rtval_list *rtval_get_list(rtval_t v) { return v.list; }
+static inline const form_t *rtval_get_form(rtval_t v) { return v.form; }
+
+#endif
+
 typedef struct rtval_list
 {
   size_t size;
@@ -74,13 +248,95 @@ typedef struct
   rtval_t value;
 } binding_t;
 
+// frames of the tree walker, allocated on first use and never moved
+typedef struct
+{
+  rtval_t *values;
+  rtval_t *top;
+  rtval_t *end;
+} value_stack_t;
+
+// lists and functions made at runtime, collected by marking from the bindings and
+// the frames of the tree walker and the vm, then freeing what was not reached
+typedef struct gc_object gc_object_t;
+
+typedef struct
+{
+  // every object allocated and not freed yet
+  gc_object_t *objects;
+  // bytes allocated since the last collection, a collection starts when it reaches threshold
+  size_t allocated;
+  size_t threshold;
+  // lists marked but whose values are not yet
+  size_t mark_size;
+  size_t mark_capacity;
+  const rtval_list_t **marks;
+  // values the host holds between calls, roots until unpinned
+  size_t pin_size;
+  size_t pin_capacity;
+  rtval_t *pins;
+} gc_heap_t;
+
+typedef enum
+{
+  // bytecode vm
+  ENGINE_VM,
+  // walks the compiled nodes, kept as a reference for the vm
+  ENGINE_TREE,
+  // the vm, with functions on i32s and f64s compiled to native code when the target supports it
+  ENGINE_JIT,
+} engine_t;
+
 typedef struct
 {
   int size;
   int capacity;
   binding_t *bindings;
+  engine_t engine;
+  // everything the environment allocates comes from here
+  const allocator_t *allocator;
+  // the environment's own pool when it was not given an allocator, destroyed with it
+  pool_t *pool;
+  value_stack_t stack;
+  // created on first use
+  struct vm *vm;
+  // indexed by word id, one more than the binding's index or 0 if the word has none
+  uint32_t word_slots_capacity;
+  int *word_slots;
+  // indexed by word id, the word form made for the word, words are interned so one is enough
+  uint32_t word_forms_capacity;
+  const form_t **word_forms;
+  // word forms, which live as long as the environment
+  arena_t arena;
+  // nodes of the top-level form being evaluated
+  arena_t scratch;
+  gc_heap_t heap;
 } def_env_t;
 
+// an empty environment evaluating with engine, with allocator nullptr it allocates from a pool of its own
+void def_env_init(def_env_t *denv, engine_t engine, const allocator_t *allocator);
+// index of the binding for word, reserved as undefined if not defined yet
+int def_env_slot(def_env_t *denv, const word_t *word);
+// the form of word, made once and living as long as the environment
+const form_t *def_env_word_form(def_env_t *denv, const word_t *word);
+void def_env_free(def_env_t *denv);
 rtval_t eval_top(def_env_t *denv, const form_t *form);
-void form_free(const form_t *form);
+// evaluate a compiled expression with the tree walker whatever the engine, macros are expanded with it
+rtval_t eval_tree(def_env_t *denv, const struct node *node, int frame_size);
+// bind the function of a compiled defn or defmacro
+rtval_t define_func(def_env_t *denv, const struct node *defn);
 void print_rtval(const rtval_t *val);
+
+// may collect first, so every value still needed must be reachable from a root
+// the values of the list are undefined until set
+rtval_list_t *gc_alloc_list(def_env_t *denv, size_t size);
+rtfunc_t *gc_alloc_func(def_env_t *denv);
+void gc_collect(def_env_t *denv);
+// hand the objects reachable from value over to the host, they are no longer collected or freed with the heap,
+// so the environment's allocator must outlive it
+void gc_release(def_env_t *denv, rtval_t value);
+// keep the objects reachable from value while the host holds it, a value pinned twice needs two unpins
+void gc_pin(def_env_t *denv, rtval_t value);
+void gc_unpin(def_env_t *denv, rtval_t value);
+// free every object
+void gc_free(def_env_t *denv);
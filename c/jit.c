@@ -0,0 +1,573 @@
+// mmap's MAP_ANONYMOUS is hidden by glibc in strict c2x mode
+#define _DEFAULT_SOURCE
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "jit.h"
+
+#if defined(__x86_64__) && !defined(__EMSCRIPTEN__)
+
+#include <sys/mman.h>
+
+#define INIT_JIT_CAPACITY 256
+// arguments are passed to the native code in an array of this many 8 byte values
+#define JIT_MAX_ARITY 16
+
+// the static type of a native value, i32s are in eax and f64s in xmm0
+typedef enum
+{
+  JIT_NONE,
+  JIT_I32,
+  JIT_F64,
+} jit_type_t;
+
+// takes the raw arguments, i32s zero extended and f64s as their bits
+typedef uint64_t (*jit_fn_t)(const uint64_t *args);
+
+struct jit_code
+{
+  jit_fn_t fn;
+  // bytes mapped for fn
+  size_t size;
+  int arity;
+  jit_type_t result;
+  jit_type_t params[JIT_MAX_ARITY];
+};
+
+typedef struct
+{
+  const allocator_t *allocator;
+  uint8_t *code;
+  size_t size;
+  size_t capacity;
+  // the type of the value each slot currently holds
+  jit_type_t *slot_types;
+  // start of the innermost loop body, a continue in tail position jumps there
+  size_t loop_top;
+} jit_t;
+
+// the first slots are kept in callee-saved registers when they hold i32s and in xmm8-xmm15
+// when they hold f64s, the rest live below them in the native frame
+static const uint8_t i32_slot_regs[] = {3 /* rbx */, 12, 13, 14, 15};
+#define I32_SLOT_REGS (sizeof(i32_slot_regs) / sizeof(i32_slot_regs[0]))
+#define F64_SLOT_REGS 8
+// rbp, then the saved rbx and r12-r15
+#define SAVED_REGS_SIZE 40
+
+static void emit(jit_t *j, size_t n, const uint8_t *bytes)
+{
+  if (j->size + n > j->capacity)
+  {
+    const size_t old_capacity = j->capacity;
+    while (j->size + n > j->capacity)
+      j->capacity = j->capacity ? j->capacity * 2 : INIT_JIT_CAPACITY;
+    j->code = allocator_realloc(j->allocator, j->code, old_capacity, j->capacity);
+  }
+  memcpy(j->code + j->size, bytes, n);
+  j->size += n;
+}
+
+#define EMIT(j, ...) emit(j, sizeof((const uint8_t[]){__VA_ARGS__}), (const uint8_t[]){__VA_ARGS__})
+
+static void emit32(jit_t *j, int32_t v)
+{
+  uint8_t bytes[4];
+  memcpy(bytes, &v, 4);
+  emit(j, 4, bytes);
+}
+
+static void emit64(jit_t *j, uint64_t v)
+{
+  uint8_t bytes[8];
+  memcpy(bytes, &v, 8);
+  emit(j, 8, bytes);
+}
+
+// emit a jump with a rel32 to be patched, returns its offset
+static size_t emit_jump(jit_t *j, size_t n, const uint8_t *opcode)
+{
+  emit(j, n, opcode);
+  emit32(j, 0);
+  return j->size - 4;
+}
+
+static void patch_jump(jit_t *j, size_t at, size_t target)
+{
+  const int32_t rel = (int32_t)(target - (at + 4));
+  memcpy(j->code + at, &rel, 4);
+}
+
+static int32_t slot_disp(int slot)
+{
+  return -(SAVED_REGS_SIZE + 8 * (slot + 1));
+}
+
+// mov between eax and a 32 bit register
+static void emit_mov_r32(jit_t *j, int dst, int src)
+{
+  const uint8_t rex = 0x40 | (src >= 8 ? 4 : 0) | (dst >= 8 ? 1 : 0);
+  if (rex != 0x40)
+    EMIT(j, rex);
+  EMIT(j, 0x89, 0xC0 | (src & 7) << 3 | (dst & 7));
+}
+
+static void load_slot(jit_t *j, int slot, jit_type_t type)
+{
+  if (type == JIT_I32)
+  {
+    if (slot < (int)I32_SLOT_REGS)
+      emit_mov_r32(j, 0, i32_slot_regs[slot]);
+    else
+    {
+      // mov eax, [rbp + disp32]
+      EMIT(j, 0x8B, 0x85);
+      emit32(j, slot_disp(slot));
+    }
+  }
+  else if (slot < F64_SLOT_REGS)
+    // movsd xmm0, xmm8+slot
+    EMIT(j, 0xF2, 0x41, 0x0F, 0x10, 0xC0 | slot);
+  else
+  {
+    // movsd xmm0, [rbp + disp32]
+    EMIT(j, 0xF2, 0x0F, 0x10, 0x85);
+    emit32(j, slot_disp(slot));
+  }
+}
+
+static void store_slot(jit_t *j, int slot, jit_type_t type)
+{
+  j->slot_types[slot] = type;
+  if (type == JIT_I32)
+  {
+    if (slot < (int)I32_SLOT_REGS)
+      emit_mov_r32(j, i32_slot_regs[slot], 0);
+    else
+    {
+      // mov [rbp + disp32], eax
+      EMIT(j, 0x89, 0x85);
+      emit32(j, slot_disp(slot));
+    }
+  }
+  else if (slot < F64_SLOT_REGS)
+    // movsd xmm8+slot, xmm0
+    EMIT(j, 0xF2, 0x44, 0x0F, 0x10, 0xC0 | slot << 3);
+  else
+  {
+    // movsd [rbp + disp32], xmm0
+    EMIT(j, 0xF2, 0x0F, 0x11, 0x85);
+    emit32(j, slot_disp(slot));
+  }
+}
+
+static bool jit_node(jit_t *j, const node_t *node, jit_type_t *type);
+
+// evaluates a to eax or xmm0 and b to ecx or xmm1
+static bool jit_operands(jit_t *j, const node_t *a, const node_t *b, jit_type_t expected)
+{
+  jit_type_t ta, tb;
+  if (!jit_node(j, a, &ta) || ta != expected)
+    return false;
+  if (expected == JIT_I32)
+    // push rax
+    EMIT(j, 0x50);
+  else
+    // sub rsp, 8; movsd [rsp], xmm0
+    EMIT(j, 0x48, 0x83, 0xEC, 0x08, 0xF2, 0x0F, 0x11, 0x04, 0x24);
+  if (!jit_node(j, b, &tb) || tb != expected)
+    return false;
+  if (expected == JIT_I32)
+    // mov ecx, eax; pop rax
+    EMIT(j, 0x89, 0xC1, 0x58);
+  else
+    // movapd xmm1, xmm0; movsd xmm0, [rsp]; add rsp, 8
+    EMIT(j, 0x66, 0x0F, 0x28, 0xC8, 0xF2, 0x0F, 0x10, 0x04, 0x24, 0x48, 0x83, 0xC4, 0x08);
+  return true;
+}
+
+// setcc al, then zero extend it to eax
+static void emit_setcc(jit_t *j, uint8_t cc)
+{
+  EMIT(j, 0x0F, cc, 0xC0, 0x0F, 0xB6, 0xC0);
+}
+
+static bool jit_intrinsic(jit_t *j, const node_t *node, jit_type_t *type)
+{
+  const intrinsic_type_t op = node->intrinsic.op;
+  switch (intrinsic_kind(op))
+  {
+  case INTRINSIC_KIND_I32:
+    if (!jit_operands(j, node->intrinsic.a, node->intrinsic.b, JIT_I32))
+      return false;
+    *type = JIT_I32;
+    switch (op)
+    {
+    case INTRINSIC_I32_ADD:
+      EMIT(j, 0x01, 0xC8);
+      break;
+    case INTRINSIC_I32_SUB:
+      EMIT(j, 0x29, 0xC8);
+      break;
+    case INTRINSIC_I32_MUL:
+      EMIT(j, 0x0F, 0xAF, 0xC1);
+      break;
+    // cdq; idiv ecx, traps like the interpreter on division by zero
+    case INTRINSIC_I32_DIV_S:
+      EMIT(j, 0x99, 0xF7, 0xF9);
+      break;
+    // and the remainder is in edx
+    case INTRINSIC_I32_REM_S:
+      EMIT(j, 0x99, 0xF7, 0xF9, 0x89, 0xD0);
+      break;
+    case INTRINSIC_I32_AND:
+      EMIT(j, 0x21, 0xC8);
+      break;
+    case INTRINSIC_I32_OR:
+      EMIT(j, 0x09, 0xC8);
+      break;
+    case INTRINSIC_I32_XOR:
+      EMIT(j, 0x31, 0xC8);
+      break;
+    case INTRINSIC_I32_SHL:
+      EMIT(j, 0xD3, 0xE0);
+      break;
+    case INTRINSIC_I32_SHR_S:
+      EMIT(j, 0xD3, 0xF8);
+      break;
+    case INTRINSIC_I32_SHR_U:
+      EMIT(j, 0xD3, 0xE8);
+      break;
+    default:
+      // cmp eax, ecx
+      EMIT(j, 0x39, 0xC8);
+      switch (op)
+      {
+      case INTRINSIC_I32_EQ:
+        emit_setcc(j, 0x94);
+        break;
+      case INTRINSIC_I32_NE:
+        emit_setcc(j, 0x95);
+        break;
+      case INTRINSIC_I32_LT_S:
+        emit_setcc(j, 0x9C);
+        break;
+      case INTRINSIC_I32_GT_S:
+        emit_setcc(j, 0x9F);
+        break;
+      case INTRINSIC_I32_LE_S:
+        emit_setcc(j, 0x9E);
+        break;
+      case INTRINSIC_I32_GE_S:
+        emit_setcc(j, 0x9D);
+        break;
+      default:
+        return false;
+      }
+    }
+    return true;
+  case INTRINSIC_KIND_F64_ARITH:
+    if (!jit_operands(j, node->intrinsic.a, node->intrinsic.b, JIT_F64))
+      return false;
+    *type = JIT_F64;
+    switch (op)
+    {
+    case INTRINSIC_F64_ADD:
+      EMIT(j, 0xF2, 0x0F, 0x58, 0xC1);
+      break;
+    case INTRINSIC_F64_SUB:
+      EMIT(j, 0xF2, 0x0F, 0x5C, 0xC1);
+      break;
+    case INTRINSIC_F64_MUL:
+      EMIT(j, 0xF2, 0x0F, 0x59, 0xC1);
+      break;
+    case INTRINSIC_F64_DIV:
+      EMIT(j, 0xF2, 0x0F, 0x5E, 0xC1);
+      break;
+    default:
+      return false;
+    }
+    return true;
+  case INTRINSIC_KIND_F64_CMP:
+    if (!jit_operands(j, node->intrinsic.a, node->intrinsic.b, JIT_F64))
+      return false;
+    *type = JIT_I32;
+    // unordered operands set ZF, PF and CF, so nan compares false except for ne,
+    // lt and le swap the operands to test CF clear like gt and ge
+    switch (op)
+    {
+    case INTRINSIC_F64_EQ:
+      // ucomisd xmm0, xmm1; sete al; setnp cl; and al, cl
+      EMIT(j, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x94, 0xC0, 0x0F, 0x9B, 0xC1, 0x20, 0xC8, 0x0F, 0xB6, 0xC0);
+      break;
+    case INTRINSIC_F64_NE:
+      // ucomisd xmm0, xmm1; setne al; setp cl; or al, cl
+      EMIT(j, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x95, 0xC0, 0x0F, 0x9A, 0xC1, 0x08, 0xC8, 0x0F, 0xB6, 0xC0);
+      break;
+    case INTRINSIC_F64_GT:
+      EMIT(j, 0x66, 0x0F, 0x2E, 0xC1);
+      emit_setcc(j, 0x97);
+      break;
+    case INTRINSIC_F64_GE:
+      EMIT(j, 0x66, 0x0F, 0x2E, 0xC1);
+      emit_setcc(j, 0x93);
+      break;
+    case INTRINSIC_F64_LT:
+      EMIT(j, 0x66, 0x0F, 0x2E, 0xC8);
+      emit_setcc(j, 0x97);
+      break;
+    case INTRINSIC_F64_LE:
+      EMIT(j, 0x66, 0x0F, 0x2E, 0xC8);
+      emit_setcc(j, 0x93);
+      break;
+    default:
+      return false;
+    }
+    return true;
+  }
+  return false;
+}
+
+// evaluate the bindings in order and store them to their slots, a later value sees the earlier ones
+static bool jit_bindings(jit_t *j, size_t size, const node_binding_t *bindings)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    jit_type_t t;
+    if (!jit_node(j, bindings[i].value, &t) || t == JIT_NONE)
+      return false;
+    store_slot(j, bindings[i].slot, t);
+  }
+  return true;
+}
+
+// generates code leaving the value of node in eax or xmm0, type is JIT_NONE if it
+// always jumps back to its loop, returns false if node is not supported
+static bool jit_node(jit_t *j, const node_t *node, jit_type_t *type)
+{
+  switch (node->kind)
+  {
+  case N_I32:
+    // mov eax, imm32
+    EMIT(j, 0xB8);
+    emit32(j, node->i32);
+    *type = JIT_I32;
+    return true;
+  case N_F64:
+  {
+    uint64_t bits;
+    memcpy(&bits, &node->f64, sizeof(double));
+    // mov rax, imm64; movq xmm0, rax
+    EMIT(j, 0x48, 0xB8);
+    emit64(j, bits);
+    EMIT(j, 0x66, 0x48, 0x0F, 0x6E, 0xC0);
+    *type = JIT_F64;
+    return true;
+  }
+  case N_LOCAL:
+    *type = j->slot_types[node->slot];
+    if (*type == JIT_NONE)
+      return false;
+    load_slot(j, node->slot, *type);
+    return true;
+  case N_INTRINSIC:
+  case N_INTRINSIC_UNCHECKED:
+    return jit_intrinsic(j, node, type);
+  case N_CHECK:
+    // the argument tags are known, so the check either always passes or the vm runs the function
+    return jit_node(j, node->check.value, type) && *type == (node->type == TYPE_I32 ? JIT_I32 : JIT_F64);
+  case N_IF:
+  {
+    jit_type_t cond, then, otherwise;
+    if (!jit_node(j, node->if_.cond, &cond) || cond != JIT_I32)
+      return false;
+    // test eax, eax; je else
+    EMIT(j, 0x85, 0xC0);
+    const size_t to_else = emit_jump(j, 2, (const uint8_t[]){0x0F, 0x84});
+    if (!jit_node(j, node->if_.then, &then))
+      return false;
+    const size_t to_end = emit_jump(j, 1, (const uint8_t[]){0xE9});
+    patch_jump(j, to_else, j->size);
+    if (!jit_node(j, node->if_.otherwise, &otherwise))
+      return false;
+    patch_jump(j, to_end, j->size);
+    // a branch that continues its loop does not produce a value
+    if (then != JIT_NONE && otherwise != JIT_NONE && then != otherwise)
+      return false;
+    *type = then != JIT_NONE ? then : otherwise;
+    return true;
+  }
+  case N_DO:
+    if (node->seq.size == 0)
+      return false;
+    for (size_t i = 0; i < node->seq.size; i++)
+      if (!jit_node(j, node->seq.exps[i], type))
+        return false;
+    return true;
+  case N_LET:
+    return jit_bindings(j, node->let.size, node->let.bindings) && jit_node(j, node->let.body, type);
+  case N_LOOP:
+  {
+    if (!node->let.jump_continues || !jit_bindings(j, node->let.size, node->let.bindings))
+      return false;
+    const size_t outer_top = j->loop_top;
+    j->loop_top = j->size;
+    const bool ok = jit_node(j, node->let.body, type);
+    j->loop_top = outer_top;
+    return ok && *type != JIT_NONE;
+  }
+  case N_CONTINUE:
+  {
+    if (node->cont.loop == nullptr)
+      return false;
+    // the slots must keep the types the loop body was compiled for
+    for (size_t i = 0; i < node->cont.size; i++)
+    {
+      const int slot = node->cont.bindings[i].slot;
+      const jit_type_t before = j->slot_types[slot];
+      jit_type_t t;
+      if (!jit_node(j, node->cont.bindings[i].value, &t) || t != before)
+        return false;
+      store_slot(j, slot, t);
+    }
+    // jmp loop_top
+    EMIT(j, 0xE9);
+    emit32(j, (int32_t)(j->loop_top - (j->size + 4)));
+    *type = JIT_NONE;
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+const jit_code_t *jit_compile(const allocator_t *allocator, const rtfunc_t *func, const rtval_t *args)
+{
+  if (func->has_rest || func->arity > JIT_MAX_ARITY)
+    return nullptr;
+  jit_code_t code = {.arity = func->arity};
+  for (int i = 0; i < func->arity; i++)
+  {
+    switch (rtval_get_tag(args[i]))
+    {
+    case rtval_i32:
+      code.params[i] = JIT_I32;
+      break;
+    case rtval_f64:
+      code.params[i] = JIT_F64;
+      break;
+    default:
+      return nullptr;
+    }
+  }
+  const size_t slot_types_size = sizeof(jit_type_t) * (func->frame_size + 1);
+  jit_t j = {.allocator = allocator, .slot_types = allocator_alloc(allocator, slot_types_size)};
+  memset(j.slot_types, 0, slot_types_size);
+  // push rbp; mov rbp, rsp; push rbx; push r12; push r13; push r14; push r15; sub rsp, imm32
+  EMIT(&j, 0x55, 0x48, 0x89, 0xE5, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57, 0x48, 0x81, 0xEC);
+  emit32(&j, 8 * func->frame_size);
+  for (int i = 0; i < func->arity; i++)
+  {
+    if (code.params[i] == JIT_I32)
+      // mov eax, [rdi + disp32]
+      EMIT(&j, 0x8B, 0x87);
+    else
+      // movsd xmm0, [rdi + disp32]
+      EMIT(&j, 0xF2, 0x0F, 0x10, 0x87);
+    emit32(&j, 8 * i);
+    store_slot(&j, i, code.params[i]);
+  }
+  const bool ok = jit_node(&j, func->body, &code.result) && code.result != JIT_NONE;
+  allocator_free(allocator, j.slot_types, slot_types_size);
+  if (!ok)
+  {
+    allocator_free(allocator, j.code, j.capacity);
+    return nullptr;
+  }
+  if (code.result == JIT_F64)
+    // movq rax, xmm0
+    EMIT(&j, 0x66, 0x48, 0x0F, 0x7E, 0xC0);
+  // lea rsp, [rbp - 40]; pop r15; pop r14; pop r13; pop r12; pop rbx; pop rbp; ret
+  EMIT(&j, 0x48, 0x8D, 0x65, 0xD8, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0x5D, 0xC3);
+
+  // the code is written while the pages are writable and only executable after
+  void *mem = mmap(nullptr, j.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+  {
+    allocator_free(allocator, j.code, j.capacity);
+    return nullptr;
+  }
+  memcpy(mem, j.code, j.size);
+  allocator_free(allocator, j.code, j.capacity);
+  if (mprotect(mem, j.size, PROT_READ | PROT_EXEC) != 0)
+  {
+    munmap(mem, j.size);
+    return nullptr;
+  }
+  code.fn = (jit_fn_t)mem;
+  code.size = j.size;
+  jit_code_t *result = allocator_alloc(allocator, sizeof(jit_code_t));
+  memcpy(result, &code, sizeof(jit_code_t));
+  return result;
+}
+
+bool jit_call(const jit_code_t *code, const rtval_t *args, rtval_t *result)
+{
+  uint64_t raw[JIT_MAX_ARITY];
+  for (int i = 0; i < code->arity; i++)
+  {
+    if (code->params[i] == JIT_I32)
+    {
+      if (rtval_get_tag(args[i]) != rtval_i32)
+        return false;
+      raw[i] = (uint32_t)rtval_get_i32(args[i]);
+    }
+    else
+    {
+      if (rtval_get_tag(args[i]) != rtval_f64)
+        return false;
+      const double f = rtval_get_f64(args[i]);
+      memcpy(&raw[i], &f, sizeof(double));
+    }
+  }
+  const uint64_t ret = code->fn(raw);
+  if (code->result == JIT_I32)
+  {
+    *result = rtval_make_i32((int32_t)(uint32_t)ret);
+  }
+  else
+  {
+    double f;
+    memcpy(&f, &ret, sizeof(double));
+    *result = rtval_make_f64(f);
+  }
+  return true;
+}
+
+void jit_free(const allocator_t *allocator, const jit_code_t *code)
+{
+  if (code == nullptr)
+    return;
+  munmap((void *)code->fn, code->size);
+  allocator_free(allocator, (void *)code, sizeof(jit_code_t));
+}
+
+#else
+
+const jit_code_t *jit_compile(const allocator_t *, const rtfunc_t *, const rtval_t *)
+{
+  return nullptr;
+}
+
+bool jit_call(const jit_code_t *, const rtval_t *, rtval_t *)
+{
+  return false;
+}
+
+void jit_free(const allocator_t *, const jit_code_t *)
+{
+}
+
+#endif
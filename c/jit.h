@@ -0,0 +1,16 @@
+#pragma once
+
+#include "compile.h"
+
+// native code for functions that only compute on i32 and f64 values,
+// the body may use literals, its own slots, intrinsics, if, do, let and loop
+// with continues in tail position, anything else is left to the vm
+typedef struct jit_code jit_code_t;
+
+// compile func for the tags of args, nullptr if the body or the tags are not supported
+// or there is no native code generator for this target, the code is allocated from allocator
+const jit_code_t *jit_compile(const allocator_t *allocator, const rtfunc_t *func, const rtval_t *args);
+// run the native code if args have the tags it was compiled for, returns false if they do not
+bool jit_call(const jit_code_t *code, const rtval_t *args, rtval_t *result);
+// release the native code of a function that is collected, code may be nullptr
+void jit_free(const allocator_t *allocator, const jit_code_t *code);
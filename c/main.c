@@ -1,12 +1,20 @@
+// posix_madvise and friends are hidden by glibc in strict c2x mode
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <execinfo.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "interpreter2.h"
+#include "parse_parallel.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -14,8 +22,45 @@ typedef struct
 {
   const char *start;
   const char *end;
+  // non-zero when start points into a read-only file mapping instead of a heap buffer
+  size_t mapped_size;
 } char_range_t;
 
+// Map a source file read-only, the parser reads it in place so nothing is copied
+// Returns NULL if the file cannot be mapped, the caller falls back to reading it
+char_range_t *mapFileToRange(const char *filename)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+  {
+    // empty files and non-regular files cannot be mapped
+    close(fd);
+    return NULL;
+  }
+  void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return NULL;
+  posix_madvise(mapping, st.st_size, POSIX_MADV_SEQUENTIAL);
+  char_range_t *range = malloc(sizeof(char_range_t));
+  range->start = mapping;
+  range->end = (const char *)mapping + st.st_size;
+  range->mapped_size = st.st_size;
+  return range;
+}
+
+void freeRange(char_range_t *range)
+{
+  if (range->mapped_size)
+    munmap((void *)range->start, range->mapped_size);
+  else
+    free((void *)range->start);
+  free(range);
+}
+
 // Function to read an entire text file into a dynamically allocated string
 char_range_t *readFileToString(const char *filename)
 {
@@ -72,6 +117,7 @@ char_range_t *readFileToString(const char *filename)
   char_range_t *range = malloc(sizeof(char_range_t));
   range->start = buffer;
   range->end = buffer + bytesRead;
+  range->mapped_size = 0;
   return range;
 }
 
@@ -89,80 +135,160 @@ void handler(int sig)
   exit(1);
 }
 
-#define CHUNK_SIZE 1024 // Define the size of chunks to read at a time
+void evalForm(def_env_t *denv, const form_t *form)
+{
+  print_form(form);
+  rtval_t result = eval_top(denv, form);
+  printf(" => ");
+  print_rtval(&result);
+  printf("\n");
+}
+
+// Parse and evaluate the forms in [start, end)
+void evalRange(def_env_t *denv, arena_t *forms, const char *start, const char *end)
+{
+  parser_t *parser = parser_create(forms, nullptr, nullptr);
+  const char **cur = &start;
+  while (start < end)
+  {
+    const form_t *form = parse_one(parser, cur, end);
+    if (!form)
+      break;
+    evalForm(denv, form);
+    arena_reset(forms);
+  }
+  parser_free(parser);
+}
+
+#define STREAM_CHUNK_SIZE (64 * 1024)
 
-char_range_t *readStdinToRange()
+typedef struct
 {
+  def_env_t *denv;
+  arena_t *forms;
+} stream_ctx_t;
 
-  char *buffer = NULL;
-  size_t size = 0;   // Total size of the buffer
-  size_t length = 0; // Length of the string in the buffer
-  char chunk[CHUNK_SIZE];
+bool evalStreamForm(void *ctx, const form_t *form)
+{
+  stream_ctx_t *s = ctx;
+  evalForm(s->denv, form);
+  arena_reset(s->forms);
+  return true;
+}
 
-  while (fgets(chunk, CHUNK_SIZE, stdin))
+// Evaluate forms from a file descriptor as soon as they are complete,
+// only the chunk being read and the unfinished form are kept in memory
+int evalStream(int fd, def_env_t *denv)
+{
+  char *chunk = malloc(STREAM_CHUNK_SIZE);
+  arena_t forms = {.allocator = denv->allocator};
+  stream_ctx_t ctx = {.denv = denv, .forms = &forms};
+  parser_t *parser = parser_create(&forms, evalStreamForm, &ctx);
+  int status = 0;
+  while (true)
   {
-    size_t chunkLength = strlen(chunk);
-    char *newBuffer = realloc(buffer, size + chunkLength + 1);
-    if (newBuffer == NULL)
+    const ssize_t n = read(fd, chunk, STREAM_CHUNK_SIZE);
+    if (n < 0)
     {
-      perror("Error reallocating memory");
-      free(buffer);
-      return NULL;
+      if (errno == EINTR)
+        continue;
+      perror("Error reading from file");
+      status = 1;
+      break;
     }
-    buffer = newBuffer;
-    strcpy(buffer + length, chunk);
-    length += chunkLength;
-    size += chunkLength;
-  }
-
-  if (ferror(stdin))
-  {
-    perror("Error reading from file");
-    free(buffer);
-    return NULL;
+    if (n == 0)
+    {
+      parser_finish(parser);
+      break;
+    }
+    const char *start = chunk;
+    const bool keep_going = parser_feed(parser, &start, chunk + n);
+    fflush(stdout);
+    if (!keep_going)
+      break;
   }
+  fflush(stdout);
+  parser_free(parser);
+  arena_free(&forms);
+  free(chunk);
+  return status;
+}
 
-  char_range_t *range = malloc(sizeof(char_range_t));
-  range->start = buffer;
-  range->end = buffer + length;
-  return range;
+void usage(const char *program)
+{
+  fprintf(stderr, "usage: %s [-j threads] [-e vm|tree|jit] [file]\n", program);
+  fprintf(stderr, "  -j threads  parse file on this many threads before evaluating it\n");
+  fprintf(stderr, "  -e engine   evaluate with the bytecode vm (default), the reference tree walker\n");
+  fprintf(stderr, "              or the vm with numeric functions compiled to native code\n");
+  exit(1);
 }
 
 int main(int argc, char **argv)
 {
   signal(SIGSEGV, handler); // install our handler
 
-  const int initial_capacity = 128;
-  binding_t *defBindings = malloc(sizeof(binding_t) * initial_capacity);
-  def_env_t denv = (def_env_t){.size = 0, .capacity = initial_capacity, .bindings = defBindings};
-
-  char_range_t *range;
-  if (argc == 2)
+  const char *filename = NULL;
+  int parse_threads = 0;
+  engine_t engine = ENGINE_VM;
+  for (int i = 1; i < argc; i++)
   {
-    range = readFileToString(argv[1]);
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+    {
+      parse_threads = atoi(argv[++i]);
+      if (parse_threads < 1)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+    {
+      const char *name = argv[++i];
+      if (strcmp(name, "vm") == 0)
+        engine = ENGINE_VM;
+      else if (strcmp(name, "tree") == 0)
+        engine = ENGINE_TREE;
+      else if (strcmp(name, "jit") == 0)
+        engine = ENGINE_JIT;
+      else
+        usage(argv[0]);
+    }
+    else if (argv[i][0] == '-' || filename != NULL)
+      usage(argv[0]);
+    else
+      filename = argv[i];
   }
-  else
+
+  def_env_t denv;
+  def_env_init(&denv, engine, nullptr);
+
+  int status = 0;
+  if (filename != NULL)
   {
-    range = readStdinToRange();
+    char_range_t *range = mapFileToRange(filename);
+    if (range == NULL)
+      range = readFileToString(filename);
+    if (range == NULL)
+      return 1;
+    if (parse_threads > 0)
+    {
+      // all forms are parsed up front, evaluation is still in order
+      parsed_forms_t parsed = parse_parallel(range->start, range->end, parse_threads);
+      for (size_t i = 0; i < parsed.size; i++)
+        evalForm(&denv, parsed.forms[i]);
+      parsed_forms_free(&parsed);
+    }
+    else
+    {
+      // one arena per top-level form, reset after it has been evaluated
+      arena_t forms = {.allocator = denv.allocator};
+      evalRange(&denv, &forms, range->start, range->end);
+      arena_free(&forms);
+    }
+    // defn bodies are compiled to nodes that do not point into the source, so the mapping can go
+    freeRange(range);
   }
-
-  const char *start = range->start;
-  const char *end = range->end;
-  const char **cur = &start;
-  while (start < end)
+  else
   {
-    const form_t *form = parse_one(cur, end);
-    if (!form)
-      break;
-    print_form(form);
-    rtval_t result = eval_top(&denv, form);
-    form_free((form_t *)form);
-    printf(" => ");
-    print_rtval(&result);
-    printf("\n");
+    status = evalStream(STDIN_FILENO, &denv);
   }
-  free(defBindings);
-  free((void *)range->start);
-  free(range);
-  return 0;
+  def_env_free(&denv);
+  return status;
 }
@@ -0,0 +1,174 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parse_parallel.h"
+#include "scan.h"
+
+// smaller sources are not worth the thread startup
+#define MIN_SEGMENT_SIZE (64 * 1024)
+#define INIT_FORMS_CAPACITY 256
+
+typedef struct
+{
+  const char *start;
+  const char *end;
+  long depth_delta;
+} depth_task_t;
+
+typedef struct
+{
+  const char *start;
+  const char *end;
+  arena_t *arena;
+  size_t size;
+  size_t capacity;
+  const form_t **forms;
+  // an unmatched ']' ended parsing in this range
+  bool stopped;
+} parse_task_t;
+
+// run fn on every task, the calling thread takes the first one
+static void run_tasks(void *(*fn)(void *), void *tasks, size_t task_size, int count)
+{
+  pthread_t *threads = malloc(sizeof(pthread_t) * count);
+  bool *started = calloc(count, sizeof(bool));
+  for (int i = 1; i < count; i++)
+    started[i] = pthread_create(&threads[i], nullptr, fn, (char *)tasks + i * task_size) == 0;
+  fn(tasks);
+  for (int i = 1; i < count; i++)
+  {
+    if (started[i])
+      pthread_join(threads[i], nullptr);
+    else
+      fn((char *)tasks + i * task_size);
+  }
+  free(started);
+  free(threads);
+}
+
+static void *depth_task_run(void *arg)
+{
+  depth_task_t *task = arg;
+  long delta = 0;
+  for (const char *cur = task->start; cur < task->end; cur++)
+    delta += (*cur == '[') - (*cur == ']');
+  task->depth_delta = delta;
+  return nullptr;
+}
+
+static bool collect_form(void *ctx, const form_t *form)
+{
+  parse_task_t *task = ctx;
+  if (task->size == task->capacity)
+  {
+    task->capacity = task->capacity ? task->capacity * 2 : INIT_FORMS_CAPACITY;
+    task->forms = realloc(task->forms, sizeof(form_t *) * task->capacity);
+  }
+  task->forms[task->size++] = form;
+  return true;
+}
+
+static void *parse_task_run(void *arg)
+{
+  parse_task_t *task = arg;
+  parser_t *parser = parser_create(task->arena, collect_form, task);
+  const char *cur = task->start;
+  if (parser_feed(parser, &cur, task->end))
+    parser_finish(parser);
+  else
+    task->stopped = true;
+  parser_free(parser);
+  return nullptr;
+}
+
+// the first position from cur at which the parser is between top-level forms,
+// that is at depth zero and not inside a word
+static const char *find_split(const char *source_start, const char *cur, const char *end, long depth)
+{
+  for (; cur < end; cur++)
+  {
+    // a negative depth means an unmatched ']' stops parsing before here, any split will do
+    if (depth <= 0 && (cur == source_start || !is_word_char(cur[-1]) || !is_word_char(*cur)))
+      return cur;
+    depth += (*cur == '[') - (*cur == ']');
+  }
+  return end;
+}
+
+parsed_forms_t parse_parallel(const char *start, const char *end, int thread_count)
+{
+  const size_t length = end - start;
+  int segment_count = thread_count;
+  if ((size_t)segment_count > length / MIN_SEGMENT_SIZE)
+    segment_count = length / MIN_SEGMENT_SIZE;
+  if (segment_count < 1)
+    segment_count = 1;
+  // pick the scan kernels before any thread races to do it
+  scan_best_impl();
+
+  // prefix scan of bracket depth to know the depth at the start of each segment
+  depth_task_t *depth_tasks = malloc(sizeof(depth_task_t) * segment_count);
+  for (int i = 0; i < segment_count; i++)
+    depth_tasks[i] = (depth_task_t){.start = start + length * i / segment_count,
+                                    .end = start + length * (i + 1) / segment_count};
+  run_tasks(depth_task_run, depth_tasks, sizeof(depth_task_t), segment_count);
+
+  // move each nominal segment start forward to the next form boundary
+  parse_task_t *parse_tasks = calloc(segment_count, sizeof(parse_task_t));
+  arena_t *arenas = calloc(segment_count, sizeof(arena_t));
+  long depth = 0;
+  for (int i = 0; i < segment_count; i++)
+  {
+    const char *split = start;
+    if (i > 0)
+    {
+      const char *previous = parse_tasks[i - 1].start;
+      const char *nominal = depth_tasks[i].start;
+      split = nominal <= previous ? previous : find_split(start, nominal, end, depth);
+      parse_tasks[i - 1].end = split;
+    }
+    parse_tasks[i].start = split;
+    parse_tasks[i].end = end;
+    parse_tasks[i].arena = &arenas[i];
+    depth += depth_tasks[i].depth_delta;
+  }
+  free(depth_tasks);
+  run_tasks(parse_task_run, parse_tasks, sizeof(parse_task_t), segment_count);
+
+  size_t total = 0;
+  int used = 0;
+  while (used < segment_count)
+  {
+    total += parse_tasks[used].size;
+    if (parse_tasks[used++].stopped)
+      break;
+  }
+  parsed_forms_t parsed = {
+      .size = total,
+      .forms = malloc(sizeof(form_t *) * total),
+      .arena_count = segment_count,
+      .arenas = arenas};
+  size_t offset = 0;
+  for (int i = 0; i < segment_count; i++)
+  {
+    if (i < used && parse_tasks[i].size > 0)
+    {
+      memcpy(parsed.forms + offset, parse_tasks[i].forms, sizeof(form_t *) * parse_tasks[i].size);
+      offset += parse_tasks[i].size;
+    }
+    free(parse_tasks[i].forms);
+  }
+  free(parse_tasks);
+  return parsed;
+}
+
+void parsed_forms_free(parsed_forms_t *parsed)
+{
+  for (int i = 0; i < parsed->arena_count; i++)
+    arena_free(&parsed->arenas[i]);
+  free(parsed->arenas);
+  free(parsed->forms);
+  *parsed = (parsed_forms_t){0};
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "interpreter2.h"
+
+// the top-level forms of a source in source order
+typedef struct
+{
+  size_t size;
+  const form_t **forms;
+  // forms are allocated from one arena per worker
+  int arena_count;
+  arena_t *arenas;
+} parsed_forms_t;
+
+// split a source at top-level form boundaries and parse the pieces on up to thread_count threads
+// as with parse_one parsing stops at an unmatched ']'
+parsed_forms_t parse_parallel(const char *start, const char *end, int thread_count);
+void parsed_forms_free(parsed_forms_t *parsed);
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "interpreter2.h"
+
+// shared by the interpreter and programs translated ahead of time to C
+
+void exitWithError(const char *message)
+{
+  if (message != NULL)
+  {
+    fprintf(stderr, "Error: %s\n", message);
+  }
+  exit(1);
+}
+
+void print_form(const form_t *form)
+{
+  switch (form->type)
+  {
+  case T_WORD:
+    printf("%s", form->word->chars);
+    break;
+  case T_LIST:
+    if (form->list->size == 0)
+    {
+      printf("[]");
+      return;
+    }
+    printf("[");
+    print_form(form->list->cells[0]);
+    for (size_t i = 1; i < form->list->size; i++)
+    {
+      printf(" ");
+      print_form(form->list->cells[i]);
+    }
+    printf("]");
+    break;
+  }
+}
+
+void print_rtval(const rtval_t *val)
+{
+  switch (rtval_get_tag(*val))
+  {
+  case rtval_i32:
+    printf("%i", rtval_get_i32(*val));
+    break;
+  case rtval_f64:
+    printf("%f", rtval_get_f64(*val));
+    break;
+  case rtval_list:
+  {
+    rtval_list_t *list = rtval_get_list(*val);
+    if (list->size == 0)
+    {
+      printf("[]");
+      return;
+    }
+    printf("[");
+    print_rtval(&list->values[0]);
+    for (size_t i = 1; i < list->size; i++)
+    {
+      printf(" ");
+      print_rtval(&list->values[i]);
+    }
+    printf("]");
+    break;
+  }
+  case rtval_form:
+    print_form(rtval_get_form(*val));
+    break;
+  case rtval_undefined:
+    printf("*undefined*");
+    break;
+  case rtval_continue:
+    printf("*continue*");
+    break;
+  case rtval_func:
+    printf("[fn %s]", rtval_get_func(*val)->name->chars);
+    break;
+  }
+}
@@ -0,0 +1,156 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+static const char *word_end_scalar(const char *cur, const char *end)
+{
+  while (cur < end && is_word_char(*cur))
+    cur++;
+  return cur;
+}
+
+static const char *whitespace_end_scalar(const char *cur, const char *end)
+{
+  while (cur < end && is_whitespace(*cur))
+    cur++;
+  return cur;
+}
+
+static const scan_impl_t scalar_impl = {"scalar", word_end_scalar, whitespace_end_scalar};
+
+#ifdef SCAN_X86
+
+// word characters are the two byte ranges '-'..'9' and 'a'..'z'
+// a byte x is in [lo, hi] iff (x - lo) ^ 0x80 < -128 + (hi - lo + 1) as signed bytes
+#define RANGE_BIAS(lo) ((char)(0x80 - (lo)))
+#define RANGE_LIMIT(lo, hi) ((char)(-128 + ((hi) - (lo) + 1)))
+
+// the masks have a bit set for every byte that does not belong to the class
+
+#define IN_RANGE_SSE2(v, lo, hi) \
+  _mm_cmpgt_epi8(_mm_set1_epi8(RANGE_LIMIT(lo, hi)), _mm_add_epi8(v, _mm_set1_epi8(RANGE_BIAS(lo))))
+#define IN_RANGE_AVX2(v, lo, hi) \
+  _mm256_cmpgt_epi8(_mm256_set1_epi8(RANGE_LIMIT(lo, hi)), _mm256_add_epi8(v, _mm256_set1_epi8(RANGE_BIAS(lo))))
+
+__attribute__((target("sse2"))) static inline uint32_t word_mask_sse2(const char *p)
+{
+  const __m128i v = _mm_loadu_si128((const __m128i *)p);
+  const __m128i word = _mm_or_si128(IN_RANGE_SSE2(v, '-', '9'), IN_RANGE_SSE2(v, 'a', 'z'));
+  return ~(uint32_t)_mm_movemask_epi8(word) & 0xffff;
+}
+
+__attribute__((target("sse2"))) static inline uint32_t whitespace_mask_sse2(const char *p)
+{
+  const __m128i v = _mm_loadu_si128((const __m128i *)p);
+  const __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+  return ~(uint32_t)_mm_movemask_epi8(ws) & 0xffff;
+}
+
+__attribute__((target("avx2"))) static inline uint32_t word_mask_avx2(const char *p)
+{
+  const __m256i v = _mm256_loadu_si256((const __m256i *)p);
+  const __m256i word = _mm256_or_si256(IN_RANGE_AVX2(v, '-', '9'), IN_RANGE_AVX2(v, 'a', 'z'));
+  return ~(uint32_t)_mm256_movemask_epi8(word);
+}
+
+__attribute__((target("avx2"))) static inline uint32_t whitespace_mask_avx2(const char *p)
+{
+  const __m256i v = _mm256_loadu_si256((const __m256i *)p);
+  const __m256i space = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+  const __m256i newline = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+  return ~(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(space, newline));
+}
+
+#define DEFINE_SCAN_SSE2(class)                                                                         \
+  __attribute__((target("sse2"))) static const char *class##_end_sse2(const char *cur, const char *end) \
+  {                                                                                                     \
+    while (end - cur >= 16)                                                                             \
+    {                                                                                                   \
+      const uint32_t mask = class##_mask_sse2(cur);                                                     \
+      if (mask != 0)                                                                                    \
+        return cur + __builtin_ctz(mask);                                                               \
+      cur += 16;                                                                                        \
+    }                                                                                                   \
+    return class##_end_scalar(cur, end);                                                                \
+  }
+
+// most runs are short, so probe 16 bytes before switching to 32 byte blocks
+#define DEFINE_SCAN_AVX2(class)                                                                         \
+  __attribute__((target("avx2"))) static const char *class##_end_avx2(const char *cur, const char *end) \
+  {                                                                                                     \
+    if (end - cur >= 16)                                                                                \
+    {                                                                                                   \
+      const uint32_t mask = class##_mask_sse2(cur);                                                     \
+      if (mask != 0)                                                                                    \
+        return cur + __builtin_ctz(mask);                                                               \
+      cur += 16;                                                                                        \
+    }                                                                                                   \
+    while (end - cur >= 32)                                                                             \
+    {                                                                                                   \
+      const uint32_t mask = class##_mask_avx2(cur);                                                     \
+      if (mask != 0)                                                                                    \
+        return cur + __builtin_ctz(mask);                                                               \
+      cur += 32;                                                                                        \
+    }                                                                                                   \
+    return class##_end_sse2(cur, end);                                                                  \
+  }
+
+DEFINE_SCAN_SSE2(word)
+DEFINE_SCAN_SSE2(whitespace)
+DEFINE_SCAN_AVX2(word)
+DEFINE_SCAN_AVX2(whitespace)
+
+static const scan_impl_t sse2_impl = {"sse2", word_end_sse2, whitespace_end_sse2};
+static const scan_impl_t avx2_impl = {"avx2", word_end_avx2, whitespace_end_avx2};
+
+#endif
+
+const scan_impl_t *const *scan_supported_impls(int *count)
+{
+  static const scan_impl_t *impls[3];
+  static int impl_count = 0;
+  if (impl_count == 0)
+  {
+    // fill before publishing the count so concurrent first calls agree
+    int n = 0;
+    impls[n++] = &scalar_impl;
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+      impls[n++] = &sse2_impl;
+    if (__builtin_cpu_supports("avx2"))
+      impls[n++] = &avx2_impl;
+#endif
+    impl_count = n;
+  }
+  *count = impl_count;
+  return impls;
+}
+
+const scan_impl_t *scan_best_impl(void)
+{
+  static const scan_impl_t *best = nullptr;
+  if (best == nullptr)
+  {
+    int count;
+    const scan_impl_t *const *impls = scan_supported_impls(&count);
+    best = impls[count - 1];
+  }
+  return best;
+}
+
+const char *scan_word_end(const char *cur, const char *end)
+{
+  return scan_best_impl()->word_end(cur, end);
+}
+
+const char *scan_whitespace_end(const char *cur, const char *end)
+{
+  return scan_best_impl()->whitespace_end(cur, end);
+}
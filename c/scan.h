@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+
+static inline bool is_whitespace(char c)
+{
+  return c == ' ' || c == '\n';
+}
+
+static inline bool is_word_char(char c)
+{
+  switch (c)
+  {
+  case '-':
+  case '.':
+  case '/':
+  case '0' ... '9':
+  case 'a' ... 'z':
+    return true;
+  default:
+    return false;
+  }
+}
+
+typedef struct
+{
+  const char *name;
+  // both return the first position in [cur, end) not matching the class, or end
+  const char *(*word_end)(const char *cur, const char *end);
+  const char *(*whitespace_end)(const char *cur, const char *end);
+} scan_impl_t;
+
+// the fastest implementation supported by the running cpu
+const scan_impl_t *scan_best_impl(void);
+// all implementations supported by the running cpu, scalar first
+const scan_impl_t *const *scan_supported_impls(int *count);
+
+const char *scan_word_end(const char *cur, const char *end);
+const char *scan_whitespace_end(const char *cur, const char *end);
@@ -0,0 +1,28 @@
+#!/bin/sh
+# runs each tests/*.wuns with every engine of ./i2 and of ./i2-nan, the nan-boxed build, read from
+# the file and streamed from stdin, and diffs the output with tests/*.out, make test builds both first
+cd "$(dirname "$0")"
+
+status=0
+check()
+{
+  expected=$1
+  shift
+  if ! "$@" 2>&1 | diff -u "$expected" - ; then
+    echo "FAILED: $*"
+    status=1
+  fi
+}
+
+for test in tests/*.wuns; do
+  expected="${test%.wuns}.out"
+  for shell in ./i2 ./i2-nan; do
+    for engine in vm tree jit; do
+      check "$expected" $shell -e $engine "$test"
+      check "$expected" sh -c "$shell -e $engine < $test"
+    done
+  done
+  check "$expected" ./i2 -j 2 "$test"
+done
+[ $status -eq 0 ] && echo ok
+exit $status